@@ -0,0 +1,205 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+/* Benchmark for mastodon_html_to_text(). Usage: bench-html [-n ITERATIONS] CORPUS...
+ *
+ * Each corpus file has one HTML status content per line, as found in the "content" attribute of a status. To get such
+ * a file from your own timeline: jq -r '.[].content' < home.json > corpus.txt
+ *
+ * For comparison, this also runs the old conversion: mastodon_strip_html() as it was before, followed by a copy of
+ * Bitlbee's strip_html(). Both are reproduced here, since the plugin no longer uses them. */
+
+#include "bench.h"
+#include "mastodon-text.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+	const char *code;
+	const char *is;
+} legacy_entities[] = {
+	{ "lt", "<" }, { "gt", ">" }, { "amp", "&" }, { "apos", "'" }, { "quot", "\"" },
+	{ "aacute", "á" }, { "eacute", "é" }, { "iacute", "í" }, { "oacute", "ó" }, { "uacute", "ú" },
+	{ "agrave", "à" }, { "egrave", "è" }, { "igrave", "ì" }, { "ograve", "ò" }, { "ugrave", "ù" },
+	{ "acirc", "â" }, { "ecirc", "ê" }, { "icirc", "î" }, { "ocirc", "ô" }, { "ucirc", "û" },
+	{ "auml", "ä" }, { "euml", "ë" }, { "iuml", "ï" }, { "ouml", "ö" }, { "uuml", "ü" },
+	{ "nbsp", " " }, { "", "" },
+};
+
+/* Bitlbee's strip_html(), second pass of the old conversion. */
+static void legacy_strip_html(char *in)
+{
+	char *start = in;
+	char out[strlen(in) + 1];
+	char *s = out, *cs;
+	int i, matched;
+	int taglen;
+
+	memset(out, 0, sizeof(out));
+
+	while (*in) {
+		if (*in == '<' && (g_ascii_isalpha(*(in + 1)) || *(in + 1) == '/')) {
+			cs = in;
+			while (*in && *in != '>') {
+				in++;
+			}
+			taglen = in - cs - 1;
+			if (*in) {
+				if (g_ascii_strncasecmp(cs + 1, "b", taglen) == 0) {
+					*(s++) = '\x02';
+				} else if (g_ascii_strncasecmp(cs + 1, "/b", taglen) == 0) {
+					*(s++) = '\x02';
+				} else if (g_ascii_strncasecmp(cs + 1, "i", taglen) == 0) {
+					*(s++) = '\x1f';
+				} else if (g_ascii_strncasecmp(cs + 1, "/i", taglen) == 0) {
+					*(s++) = '\x1f';
+				} else if (g_ascii_strncasecmp(cs + 1, "br", taglen) == 0) {
+					*(s++) = '\n';
+				} else if (g_ascii_strncasecmp(cs + 1, "br/", taglen) == 0) {
+					*(s++) = '\n';
+				} else if (g_ascii_strncasecmp(cs + 1, "br /", taglen) == 0) {
+					*(s++) = '\n';
+				}
+				in++;
+			} else {
+				in = cs;
+				*(s++) = *(in++);
+			}
+		} else if (*in == '&') {
+			cs = ++in;
+			while (*in && g_ascii_isalpha(*in)) {
+				in++;
+			}
+			if (*in == ';') {
+				in++;
+			}
+			matched = 0;
+			for (i = 0; *legacy_entities[i].code; i++) {
+				if (g_ascii_strncasecmp(legacy_entities[i].code, cs, strlen(legacy_entities[i].code)) == 0) {
+					int j;
+					for (j = 0; legacy_entities[i].is[j]; j++) {
+						*(s++) = legacy_entities[i].is[j];
+					}
+					matched = 1;
+					break;
+				}
+			}
+			if (!matched) {
+				in = cs - 1;
+				*(s++) = *(in++);
+			}
+		} else {
+			*(s++) = *(in++);
+		}
+	}
+
+	strcpy(start, out);
+}
+
+/* The old mastodon_strip_html(), first pass of the old conversion. */
+static void legacy_mastodon_strip_html(char *in)
+{
+	char *start = in;
+	char out[strlen(in) + 1];
+	char *s = out;
+
+	memset(out, 0, sizeof(out));
+
+	while (*in) {
+		if (*in == '<') {
+			if (g_ascii_strncasecmp(in + 1, "/p>", 3) == 0) {
+				*(s++) = '\n';
+				in += 4;
+			} else {
+				*(s++) = *(in++);
+			}
+		} else {
+			*(s++) = *(in++);
+		}
+	}
+	strcpy(start, out);
+	legacy_strip_html(start);
+}
+
+static void convert_legacy(char *buf, const char *in)
+{
+	strcpy(buf, in);
+	legacy_mastodon_strip_html(buf);
+}
+
+static void convert_new(char *buf, const char *in)
+{
+	mastodon_html_to_text(buf, in);
+}
+
+static void run(const char *name, void (*convert)(char *, const char *), GPtrArray *items, gsize max, int n)
+{
+	char *buf = g_malloc(max + 1);
+	guint64 bytes = 0;
+	int k;
+	guint i;
+
+	gint64 start = bench_now();
+	for (k = 0; k < n; k++) {
+		for (i = 0; i < items->len; i++) {
+			const char *in = g_ptr_array_index(items, i);
+			convert(buf, in);
+			bytes += strlen(in);
+		}
+	}
+	gint64 ns = bench_now() - start;
+
+	bench_report(name, (guint64) n * items->len, bytes, ns);
+	g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	int n = 1000;
+	int i = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		n = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "Usage: %s [-n ITERATIONS] CORPUS...\n", argv[0]);
+		return 1;
+	}
+
+	for (; i < argc; i++) {
+		GPtrArray *items = bench_read_lines(argv[i]);
+		gsize max = 0;
+		guint j;
+		for (j = 0; j < items->len; j++) {
+			max = MAX(max, strlen(g_ptr_array_index(items, j)));
+		}
+
+		printf("%s: %u items\n", argv[i], items->len);
+		run("html-to-text-legacy", convert_legacy, items, max, n);
+		run("html-to-text", convert_new, items, max, n);
+		g_ptr_array_free(items, TRUE);
+	}
+	return 0;
+}
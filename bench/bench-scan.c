@@ -0,0 +1,180 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+/* Benchmark for the byte scanners in mastodon-scan.c. Usage: bench-scan [-n ITERATIONS] STREAM [CONTENT]
+ *
+ * STREAM is a capture of the streaming API, as sent by the server. It is split into events the way
+ * mastodon_http_stream() does it, once with the string functions it used to call and once with the memchr() based
+ * scans it uses now. To record your own:
+ * curl -N -H "Authorization: Bearer $TOKEN" https://example.org/api/v1/streaming/public > federated.sse
+ *
+ * CONTENT is optional and has one HTML status content per line, as for bench-html. It is converted with
+ * mastodon_html_to_text() using each scanner available on this machine, including the one picked automatically. */
+
+#include "bench.h"
+#include "mastodon-scan.h"
+#include "mastodon-text.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+	const char *name;
+	mastodon_scan_impl_t impl;
+} impls[] = {
+	{ "auto", MASTODON_SCAN_AUTO },
+	{ "generic", MASTODON_SCAN_GENERIC },
+	{ "sse2", MASTODON_SCAN_SSE2 },
+};
+
+/* Split the stream the way mastodon_http_stream() did before: strchr() and strstr() on the NUL-terminated body.
+ * Returns the number of data lines found so that the work can't be optimized away. */
+static guint64 frame_legacy(const char *body, gsize len, guint64 *events)
+{
+	const char *p = body;
+	const char *nl;
+	guint64 lines = 0;
+
+	while (*p) {
+		if (*p == ':' && (nl = strchr(p, '\n'))) {
+			p = nl + 1;
+			continue;
+		} else if (!(nl = strstr(p, "\n\n"))) {
+			break;
+		}
+		const char *q = p;
+		while ((q = strchr(q, '\n')) && q < nl) {
+			lines++;
+			q++;
+		}
+		(*events)++;
+		p = nl + 2;
+	}
+	return lines;
+}
+
+static guint64 frame_scan(const char *body, gsize len, guint64 *events)
+{
+	const char *p = body;
+	const char *end = body + len;
+	const char *nl;
+	guint64 lines = 0;
+
+	while (p < end) {
+		if (*p == ':' && (nl = mastodon_scan_byte(p, end, '\n')) != end) {
+			p = nl + 1;
+			continue;
+		} else if ((nl = mastodon_scan_pair(p, end, '\n')) == end) {
+			break;
+		}
+		const char *q = p;
+		while ((q = mastodon_scan_byte(q, nl, '\n')) < nl) {
+			lines++;
+			q++;
+		}
+		(*events)++;
+		p = nl + 2;
+	}
+	return lines;
+}
+
+static void run_stream(const char *name, guint64 (*frame)(const char *, gsize, guint64 *),
+		       const char *body, gsize len, int n)
+{
+	guint64 events = 0, lines = 0;
+	int k;
+
+	gint64 start = bench_now();
+	for (k = 0; k < n; k++) {
+		lines += frame(body, len, &events);
+	}
+	gint64 ns = bench_now() - start;
+
+	if (lines == 0) {
+		fprintf(stderr, "%s: no data lines found\n", name);
+	}
+	bench_report(name, events, (guint64) n * len, ns);
+}
+
+static void run_html(const char *name, GPtrArray *items, gsize max, int n)
+{
+	char *buf = g_malloc(max + 1);
+	guint64 bytes = 0;
+	int k;
+	guint i;
+
+	gint64 start = bench_now();
+	for (k = 0; k < n; k++) {
+		for (i = 0; i < items->len; i++) {
+			const char *in = g_ptr_array_index(items, i);
+			mastodon_html_to_text(buf, in);
+			bytes += strlen(in);
+		}
+	}
+	gint64 ns = bench_now() - start;
+
+	bench_report(name, (guint64) n * items->len, bytes, ns);
+	g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	int n = 1000;
+	int i = 1;
+	guint j;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		n = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc || i + 2 < argc) {
+		fprintf(stderr, "Usage: %s [-n ITERATIONS] STREAM [CONTENT]\n", argv[0]);
+		return 1;
+	}
+
+	gsize len;
+	gchar *body = bench_read_file(argv[i], &len);
+	printf("%s: %" G_GSIZE_FORMAT " bytes\n", argv[i], len);
+	run_stream("stream-legacy", frame_legacy, body, len, n);
+	run_stream("stream-memchr", frame_scan, body, len, n);
+	g_free(body);
+
+	if (++i < argc) {
+		GPtrArray *items = bench_read_lines(argv[i]);
+		gsize max = 0;
+		for (j = 0; j < items->len; j++) {
+			max = MAX(max, strlen(g_ptr_array_index(items, j)));
+		}
+
+		printf("%s: %u items\n", argv[i], items->len);
+		for (j = 0; j < G_N_ELEMENTS(impls); j++) {
+			if (mastodon_scan_select(impls[j].impl)) {
+				char *name = g_strdup_printf("html-to-text-%s", impls[j].name);
+				run_html(name, items, max, n);
+				g_free(name);
+			}
+		}
+		g_ptr_array_free(items, TRUE);
+	}
+	return 0;
+}
@@ -0,0 +1,81 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Monotonic time in nanoseconds. g_get_monotonic_time() only has microseconds.
+ */
+gint64 bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Read a whole corpus file. Exits if the file cannot be read.
+ */
+gchar *bench_read_file(const char *path, gsize *len)
+{
+	GError *error = NULL;
+	gchar *contents;
+
+	if (!g_file_get_contents(path, &contents, len, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		exit(1);
+	}
+	return contents;
+}
+
+/**
+ * Read a corpus file with one item per line. Empty lines are skipped. Exits if the file cannot be read.
+ */
+GPtrArray *bench_read_lines(const char *path)
+{
+	gchar *contents = bench_read_file(path, NULL);
+	GPtrArray *lines = g_ptr_array_new_with_free_func(g_free);
+	gchar **split = g_strsplit(contents, "\n", -1);
+	int i;
+	for (i = 0; split[i]; i++) {
+		if (*split[i]) {
+			g_ptr_array_add(lines, g_strdup(split[i]));
+		}
+	}
+	g_strfreev(split);
+	g_free(contents);
+	return lines;
+}
+
+/**
+ * Print one result line. The format is meant to be easy to read and easy to parse: name, items, nanoseconds per item,
+ * megabytes of input per second.
+ */
+void bench_report(const char *name, guint64 items, guint64 bytes, gint64 ns)
+{
+	printf("%-24s %10" G_GUINT64_FORMAT " items %10.1f ns/item %8.1f MB/s\n",
+	       name, items, (double) ns / items, bytes * 1000.0 / ns);
+}
@@ -0,0 +1,33 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include <glib.h>
+
+/* Shared helpers for the benchmark programs. These are not part of the plugin. */
+
+gint64 bench_now(void);
+gchar *bench_read_file(const char *path, gsize *len);
+GPtrArray *bench_read_lines(const char *path);
+void bench_report(const char *name, guint64 items, guint64 bytes, gint64 ns);
@@ -0,0 +1,203 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon-arena.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/* A typical status with account, mentions and tags needs about 1KiB, a page of twenty statuses fits into a few
+ * blocks. Allocations larger than a quarter block get a block of their own so that they don't waste the rest of the
+ * current block. */
+#define MASTODON_ARENA_BLOCK_SIZE 4096
+#define MASTODON_ARENA_ALIGN(n) (((n) + 2 * sizeof(gpointer) - 1) & ~(2 * sizeof(gpointer) - 1))
+
+struct mastodon_arena_block {
+	struct mastodon_arena_block *next;
+	gsize size;
+	gsize used;
+	/* aligned like a pointer pair, which is good enough for our structs */
+	gpointer data[];
+};
+
+struct mastodon_arena_cleanup {
+	struct mastodon_arena_cleanup *next;
+	GDestroyNotify func;
+	gpointer data;
+};
+
+struct mastodon_arena {
+	struct mastodon_arena_block *blocks; /* the first block is the one we're allocating from */
+	struct mastodon_arena_cleanup *cleanups; /* allocated from the arena itself */
+};
+
+static struct mastodon_arena_block *mastodon_arena_block_new(gsize size)
+{
+	struct mastodon_arena_block *b = g_malloc(sizeof(struct mastodon_arena_block) + size);
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+/**
+ * Create a new, empty arena. Free it using mastodon_arena_free().
+ */
+struct mastodon_arena *mastodon_arena_new(void)
+{
+	struct mastodon_arena *arena = g_new(struct mastodon_arena, 1);
+	arena->blocks = mastodon_arena_block_new(MASTODON_ARENA_BLOCK_SIZE);
+	arena->cleanups = NULL;
+	return arena;
+}
+
+/**
+ * Free the arena and everything allocated from it.
+ */
+void mastodon_arena_free(struct mastodon_arena *arena)
+{
+	if (arena == NULL) {
+		return;
+	}
+
+	/* Most recent registration first. */
+	struct mastodon_arena_cleanup *c;
+	for (c = arena->cleanups; c; c = c->next) {
+		c->func(c->data);
+	}
+
+	struct mastodon_arena_block *b, *next;
+	for (b = arena->blocks; b; b = next) {
+		next = b->next;
+		g_free(b);
+	}
+	g_free(arena);
+}
+
+/**
+ * Allocate size bytes from the arena, zeroed.
+ */
+gpointer mastodon_arena_alloc0(struct mastodon_arena *arena, gsize size)
+{
+	if (arena == NULL) {
+		return g_malloc0(size);
+	}
+
+	struct mastodon_arena_block *b = arena->blocks;
+	gsize n = MASTODON_ARENA_ALIGN(size);
+	char *p;
+
+	if (n > MASTODON_ARENA_BLOCK_SIZE / 4) {
+		/* Large allocation: give it its own block, but keep allocating from the current one. */
+		struct mastodon_arena_block *large = mastodon_arena_block_new(n);
+		large->used = n;
+		large->next = b->next;
+		b->next = large;
+		p = (char *) large->data;
+	} else {
+		if (b->used + n > b->size) {
+			b = mastodon_arena_block_new(MASTODON_ARENA_BLOCK_SIZE);
+			b->next = arena->blocks;
+			arena->blocks = b;
+		}
+		p = (char *) b->data + b->used;
+		b->used += n;
+	}
+
+	memset(p, 0, size);
+	return p;
+}
+
+char *mastodon_arena_strndup(struct mastodon_arena *arena, const char *s, gsize len)
+{
+	if (arena == NULL) {
+		return g_strndup(s, len);
+	} else if (s == NULL) {
+		return NULL;
+	}
+
+	char *p = mastodon_arena_alloc0(arena, len + 1);
+	memcpy(p, s, len);
+	return p;
+}
+
+char *mastodon_arena_strdup(struct mastodon_arena *arena, const char *s)
+{
+	if (s == NULL) {
+		return NULL;
+	}
+	return mastodon_arena_strndup(arena, s, strlen(s));
+}
+
+char *mastodon_arena_printf(struct mastodon_arena *arena, const char *format, ...)
+{
+	va_list args;
+	char *p;
+
+	va_start(args, format);
+	if (arena == NULL) {
+		p = g_strdup_vprintf(format, args);
+	} else {
+		va_list copy;
+		va_copy(copy, args);
+		int len = vsnprintf(NULL, 0, format, copy);
+		va_end(copy);
+		p = mastodon_arena_alloc0(arena, len + 1);
+		vsnprintf(p, len + 1, format, args);
+	}
+	va_end(args);
+	return p;
+}
+
+/**
+ * Like g_slist_prepend() but the new list node belongs to the arena. Never call g_slist_free() on such a list. Use
+ * g_slist_copy() if you need a list that outlives the arena.
+ */
+GSList *mastodon_arena_slist_prepend(struct mastodon_arena *arena, GSList *list, gpointer data)
+{
+	if (arena == NULL) {
+		return g_slist_prepend(list, data);
+	}
+
+	GSList *l = mastodon_arena_new0(arena, GSList);
+	l->data = data;
+	l->next = list;
+	return l;
+}
+
+/**
+ * Call func(data) when the arena is freed. This is how the arena holds references to objects that don't belong to it,
+ * such as accounts. If arena is NULL, nothing happens and the caller remains responsible for data.
+ */
+void mastodon_arena_add_cleanup(struct mastodon_arena *arena, GDestroyNotify func, gpointer data)
+{
+	if (arena == NULL) {
+		return;
+	}
+
+	struct mastodon_arena_cleanup *c = mastodon_arena_new0(arena, struct mastodon_arena_cleanup);
+	c->func = func;
+	c->data = data;
+	c->next = arena->cleanups;
+	arena->cleanups = c;
+}
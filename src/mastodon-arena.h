@@ -0,0 +1,48 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * An arena owns everything parsed from a single response: statuses, notifications, their accounts, strings and list
+ * nodes. Nothing allocated from an arena is freed individually. Instead, mastodon_arena_free() releases it all at once.
+ * Data that must outlive the response has to be copied out using g_strdup() and friends, or in the case of accounts,
+ * by taking another reference.
+ *
+ * All functions accept a NULL arena, in which case they fall back to the regular GLib allocators and the caller owns
+ * the result as usual.
+ */
+struct mastodon_arena;
+
+struct mastodon_arena *mastodon_arena_new(void);
+void mastodon_arena_free(struct mastodon_arena *arena);
+gpointer mastodon_arena_alloc0(struct mastodon_arena *arena, gsize size);
+char *mastodon_arena_strdup(struct mastodon_arena *arena, const char *s);
+char *mastodon_arena_strndup(struct mastodon_arena *arena, const char *s, gsize len);
+char *mastodon_arena_printf(struct mastodon_arena *arena, const char *format, ...) G_GNUC_PRINTF(2, 3);
+GSList *mastodon_arena_slist_prepend(struct mastodon_arena *arena, GSList *list, gpointer data);
+void mastodon_arena_add_cleanup(struct mastodon_arena *arena, GDestroyNotify func, gpointer data);
+
+#define mastodon_arena_new0(arena, type) ((type *) mastodon_arena_alloc0((arena), sizeof(type)))
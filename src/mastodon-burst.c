@@ -0,0 +1,177 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-burst.h"
+#include <string.h>
+
+#define MASTODON_BURST_EXCERPT 50 /* characters */
+
+static guint mastodon_burst_hash(gconstpointer key)
+{
+	const struct mastodon_burst_key *k = key;
+	return g_int64_hash(&k->status_id) * 31 + k->type;
+}
+
+static gboolean mastodon_burst_equal(gconstpointer a, gconstpointer b)
+{
+	const struct mastodon_burst_key *ka = a;
+	const struct mastodon_burst_key *kb = b;
+	return ka->status_id == kb->status_id && ka->type == kb->type;
+}
+
+static void mastodon_burst_free(struct mastodon_burst *b)
+{
+	mastodon_wheel_cancel(b->timer);
+	g_ptr_array_free(b->names, TRUE);
+	g_free(b->excerpt);
+	g_free(b);
+}
+
+/**
+ * Show one line for all the notifications counted, if any.
+ */
+static void mastodon_burst_flush(struct mastodon_burst *b)
+{
+	struct mastodon_data *md = b->ic->proto_data;
+	GString *who = g_string_new("");
+	guint i;
+	int idx = -1;
+
+	if (!b->count) {
+		return;
+	}
+
+	for (i = 0; i < b->names->len; i++) {
+		if (i > 0) {
+			g_string_append(who, i + 1 == b->names->len && b->count == b->names->len ? " and " : ", ");
+		}
+		g_string_append(who, g_ptr_array_index(b->names, i));
+	}
+	if (b->count > b->names->len) {
+		guint others = b->count - b->names->len;
+		g_string_append_printf(who, " and %u other%s", others, others == 1 ? "" : "s");
+	}
+
+	for (i = 0; i < MASTODON_LOG_LENGTH; i++) {
+		if (md->log[i].id == b->key.status_id) {
+			idx = i;
+			break;
+		}
+	}
+
+	char *where = idx >= 0 ? g_strdup_printf(" [%02x]", idx) : g_strdup("");
+	mastodon_log(b->ic, "%s %s your status%s: %s", who->str,
+	             b->key.type == MN_FAVOURITE ? "favourited" : "boosted", where, b->excerpt);
+	g_free(where);
+	g_string_free(who, TRUE);
+
+	b->count = 0;
+	g_ptr_array_set_size(b->names, 0);
+}
+
+static void mastodon_burst_timeout(struct im_connection *ic, gpointer data)
+{
+	struct mastodon_burst *b = data;
+	struct mastodon_data *md = ic->proto_data;
+
+	b->timer = NULL;
+	mastodon_burst_flush(b);
+	g_hash_table_remove(md->bursts, &b->key);
+}
+
+/**
+ * Count a favourite or boost of a status for which a window is open. Returns FALSE if there is no such window, in
+ * which case the notification must be shown as usual.
+ */
+gboolean mastodon_burst_absorb(struct im_connection *ic, mastodon_notification_type_t type, guint64 status_id,
+                               const char *acct)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_burst *b;
+	struct mastodon_burst_key key = { status_id, type };
+
+	if (!md->bursts || !status_id || !(b = g_hash_table_lookup(md->bursts, &key))) {
+		return FALSE;
+	}
+
+	b->count++;
+	if (b->names->len < MASTODON_BURST_NAMES && acct) {
+		g_ptr_array_add(b->names, g_strdup(acct));
+	}
+	if (b->count >= MASTODON_BURST_MAX) {
+		mastodon_burst_flush(b);
+	}
+	return TRUE;
+}
+
+/**
+ * A favourite or boost of a status was just shown: open a window for the ones following it.
+ */
+void mastodon_burst_open(struct im_connection *ic, mastodon_notification_type_t type, guint64 status_id,
+                         const char *content)
+{
+	struct mastodon_data *md = ic->proto_data;
+	int window = set_getint(&ic->acc->set, "notification_burst");
+
+	if (window <= 0 || !status_id || (type != MN_FAVOURITE && type != MN_REBLOG)) {
+		return;
+	}
+
+	if (!md->bursts) {
+		md->bursts = g_hash_table_new_full(mastodon_burst_hash, mastodon_burst_equal, NULL,
+		                                    (GDestroyNotify) mastodon_burst_free);
+	}
+
+	struct mastodon_burst *b = g_new0(struct mastodon_burst, 1);
+	b->key.status_id = status_id;
+	b->key.type = type;
+	b->ic = ic;
+	b->names = g_ptr_array_new_with_free_func(g_free);
+
+	/* One line, and not too long. */
+	const char *s = content ? content : "";
+	const char *end = s;
+	int i;
+	for (i = 0; *end && i < MASTODON_BURST_EXCERPT; i++) {
+		end = g_utf8_next_char(end);
+	}
+	b->excerpt = *end ? g_strdup_printf("%.*s…", (int) (end - s), s) : g_strdup(s);
+	g_strdelimit(b->excerpt, "\r\n", ' ');
+
+	b->timer = mastodon_wheel_add(ic, time(NULL) + window, mastodon_burst_timeout, b);
+	g_hash_table_replace(md->bursts, &b->key, b);
+}
+
+/**
+ * Logging out: whatever was counted is lost, like everything else still pending.
+ */
+void mastodon_burst_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->bursts) {
+		g_hash_table_destroy(md->bursts);
+		md->bursts = NULL;
+	}
+}
@@ -0,0 +1,58 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+#include "mastodon-lib.h"
+#include "mastodon-wheel.h"
+
+/**
+ * Aggregating bursts of favourites and boosts. The first favourite of a status is shown as usual and opens a window
+ * of notification_burst seconds. Favourites of the same status arriving in that window are only counted, without
+ * parsing them any further, and when the window closes, one line sums them up. The same goes for boosts. If a window
+ * collects MASTODON_BURST_MAX notifications, the summary is shown early and counting starts over.
+ */
+
+#define MASTODON_BURST_MAX 100
+#define MASTODON_BURST_NAMES 3 /* accounts named in a summary; the rest are counted */
+
+struct mastodon_burst_key {
+	guint64 status_id;
+	mastodon_notification_type_t type;
+};
+
+struct mastodon_burst {
+	struct mastodon_burst_key key; /* the key of md->bursts */
+	struct im_connection *ic;
+	char *excerpt; /* the start of the status */
+	GPtrArray *names; /* the first few accounts in the window */
+	guint count;
+	struct mastodon_wheel_timer *timer;
+};
+
+gboolean mastodon_burst_absorb(struct im_connection *ic, mastodon_notification_type_t type, guint64 status_id,
+                               const char *acct);
+void mastodon_burst_open(struct im_connection *ic, mastodon_notification_type_t type, guint64 status_id,
+                         const char *content);
+void mastodon_burst_close(struct im_connection *ic);
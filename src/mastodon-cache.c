@@ -0,0 +1,141 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-cache.h"
+#include "mastodon-stats.h"
+#include <string.h>
+
+/**
+ * Find the id of the status in the raw data of an update event, between p and end, without parsing it. Mastodon
+ * writes the id first: data: {"id":"123",... Returns 0 if the data doesn't start like that.
+ */
+guint64 mastodon_status_cache_peek_id(const char *p, const char *end)
+{
+	static const char head[] = "data: {\"id\":\"";
+	guint64 id = 0;
+
+	if (end - p < (gssize) sizeof(head) || strncmp(p, head, sizeof(head) - 1) != 0) {
+		return 0;
+	}
+	for (p += sizeof(head) - 1; p < end && g_ascii_isdigit(*p); p++) {
+		id = id * 10 + (*p - '0');
+	}
+	return p < end && *p == '"' ? id : 0;
+}
+
+static void mastodon_status_cache_entry_free(struct mastodon_status_cache_entry *e)
+{
+	mastodon_wheel_cancel(e->expiry);
+	mastodon_arena_free(e->arena);
+	g_free(e);
+}
+
+/**
+ * Forget a status. Removing it from the hash table frees it.
+ */
+static void mastodon_status_cache_remove(struct mastodon_status_cache *cache, struct mastodon_status_cache_entry *e)
+{
+	g_queue_delete_link(&cache->order, e->link);
+	g_hash_table_remove(cache->entries, &e->id);
+}
+
+static void mastodon_status_cache_expire(struct im_connection *ic, gpointer data)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_status_cache_entry *e = data;
+
+	e->expiry = NULL;
+	mastodon_status_cache_remove(md->status_cache, e);
+}
+
+/**
+ * Return the status with this id if it arrived on a stream a moment ago, or NULL.
+ */
+gpointer mastodon_status_cache_get(struct im_connection *ic, guint64 id)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_status_cache_entry *e;
+
+	if (!md->status_cache || !(e = g_hash_table_lookup(md->status_cache->entries, &id))) {
+		return NULL;
+	}
+	mastodon_stats_count(ic, MS_STATUS_CACHE_HITS);
+	return e->status;
+}
+
+/**
+ * Keep a status that was just parsed from a stream. This takes over the arena.
+ */
+void mastodon_status_cache_put(struct im_connection *ic, guint64 id, struct mastodon_arena *arena, gpointer status)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_status_cache *cache = md->status_cache;
+	struct mastodon_status_cache_entry *e;
+
+	if (!cache) {
+		cache = md->status_cache = g_new0(struct mastodon_status_cache, 1);
+		cache->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+		                                       (GDestroyNotify) mastodon_status_cache_entry_free);
+		g_queue_init(&cache->order);
+	}
+
+	/* A status parsed on a worker thread may have been parsed on the main loop in the meantime. */
+	if ((e = g_hash_table_lookup(cache->entries, &id))) {
+		mastodon_status_cache_remove(cache, e);
+	}
+	if (cache->order.length >= MASTODON_STATUS_CACHE_MAX) {
+		mastodon_status_cache_remove(cache, g_queue_peek_head(&cache->order));
+	}
+
+	e = g_new0(struct mastodon_status_cache_entry, 1);
+	e->id = id;
+	e->arena = arena;
+	e->status = status;
+	e->expiry = mastodon_wheel_add(ic, time(NULL) + MASTODON_STATUS_CACHE_TTL, mastodon_status_cache_expire, e);
+	g_queue_push_tail(&cache->order, e);
+	e->link = cache->order.tail;
+	g_hash_table_insert(cache->entries, &e->id, e);
+}
+
+guint mastodon_status_cache_size(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	return md->status_cache ? md->status_cache->order.length : 0;
+}
+
+/**
+ * Logging out. This must happen before the account cache goes away, because the statuses hold accounts.
+ */
+void mastodon_status_cache_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->status_cache) {
+		g_queue_clear(&md->status_cache->order);
+		g_hash_table_destroy(md->status_cache->entries);
+		g_free(md->status_cache);
+		md->status_cache = NULL;
+	}
+}
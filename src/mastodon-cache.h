@@ -0,0 +1,58 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+#include "mastodon-arena.h"
+#include "mastodon-wheel.h"
+
+/**
+ * Statuses that arrived on a stream a moment ago. With the home timeline, lists and hashtags streaming, the same status
+ * often arrives on several streams within seconds. The first copy is parsed as usual and kept here together with its
+ * arena. Later copies are recognized by the id at the start of the raw data and skip parsing altogether: they only go
+ * through filtering and routing to channels, and the text is rendered once. Statuses are kept for
+ * MASTODON_STATUS_CACHE_TTL seconds, and at most MASTODON_STATUS_CACHE_MAX of them; the oldest go first.
+ */
+
+#define MASTODON_STATUS_CACHE_TTL 30 /* seconds */
+#define MASTODON_STATUS_CACHE_MAX 256
+
+struct mastodon_status_cache_entry {
+	guint64 id; /* of the update, which for a boost is not the id of the status boosted */
+	struct mastodon_arena *arena;
+	gpointer status; /* a struct mastodon_status from the arena */
+	struct mastodon_wheel_timer *expiry;
+	GList *link; /* in the order of arrival */
+};
+
+struct mastodon_status_cache {
+	GHashTable *entries; /* id → struct mastodon_status_cache_entry * */
+	GQueue order; /* oldest first */
+};
+
+guint64 mastodon_status_cache_peek_id(const char *p, const char *end);
+gpointer mastodon_status_cache_get(struct im_connection *ic, guint64 id);
+void mastodon_status_cache_put(struct im_connection *ic, guint64 id, struct mastodon_arena *arena, gpointer status);
+guint mastodon_status_cache_size(struct im_connection *ic);
+void mastodon_status_cache_close(struct im_connection *ic);
@@ -39,6 +39,8 @@
 #include <errno.h>
 
 #include "mastodon-http.h"
+#include "mastodon-record.h"
+#include "mastodon-stats.h"
 
 
 static char *mastodon_url_append(char *url, char *key, char *value)
@@ -139,6 +141,8 @@ struct http_request *mastodon_http(struct im_connection *ic, char *url_string, h
 	} else {
 		ret = http_dorequest(md->url_host, md->url_port, md->url_ssl, request->str, func, data);
 	}
+	mastodon_stats_request(ic, ret);
+	mastodon_record_request(ic, ret);
 
 	g_string_free(request, TRUE);
 error:
@@ -146,3 +150,118 @@ error:
 	g_free(base_url);
 	return ret;
 }
+
+#define MASTODON_HTTP_MAX_RETRIES 3
+#define MASTODON_HTTP_MAX_RETRY_DELAY 300
+
+struct mastodon_http_retry {
+	struct im_connection *ic;
+	char *request;
+	http_input_function func;
+	int attempt;
+	gint timeout; /* while waiting to be sent again */
+};
+
+/**
+ * Callback for a repeated request: hand the reply to the original callback as if nothing had happened, but let
+ * mastodon_http_retry know how often we already tried.
+ */
+static void mastodon_http_retried(struct http_request *req)
+{
+	struct mastodon_http_retry *r = req->data;
+	struct im_connection *ic = r->ic;
+
+	if (g_slist_find(mastodon_connections, ic)) {
+		struct mastodon_data *md = ic->proto_data;
+		req->data = ic;
+		req->func = r->func;
+		md->retry_attempt = r->attempt;
+		r->func(req);
+		if (g_slist_find(mastodon_connections, ic)) {
+			md->retry_attempt = 0;
+		}
+	}
+
+	g_free(r->request);
+	g_free(r);
+}
+
+static gboolean mastodon_http_retry_now(gpointer data, gint fd, b_input_condition cond)
+{
+	struct mastodon_http_retry *r = data;
+	struct mastodon_data *md = r->ic->proto_data;
+
+	/* Logging out removes the timeouts still waiting, so the connection is still there. */
+	md->retries = g_slist_remove(md->retries, r);
+	r->timeout = 0;
+
+	struct http_request *req = http_dorequest(md->url_host, md->url_port, md->url_ssl, r->request,
+	                                          mastodon_http_retried, r);
+	if (req) {
+		mastodon_stats_request(r->ic, req);
+		mastodon_record_request(r->ic, req);
+		return FALSE;
+	}
+
+	g_free(r->request);
+	g_free(r);
+	return FALSE;
+}
+
+/**
+ * Forget the requests still waiting to be repeated, when logging out.
+ */
+void mastodon_http_retry_cancel(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	GSList *l;
+
+	for (l = md->retries; l; l = g_slist_next(l)) {
+		struct mastodon_http_retry *r = l->data;
+		b_event_remove(r->timeout);
+		g_free(r->request);
+		g_free(r);
+	}
+	g_slist_free(md->retries);
+	md->retries = NULL;
+}
+
+/**
+ * Repeat a request later because the instance is overloaded or rate limiting us. Only GET requests to our instance
+ * are repeated, and only if their callback data is the connection: anything else may have been freed by the callback
+ * by the time we try again. If retry_after is positive, that's how long the server asked us to wait; otherwise we
+ * back off exponentially. Returns the delay in seconds, or 0 if the request will not be repeated.
+ */
+int mastodon_http_retry(struct im_connection *ic, struct http_request *req, int retry_after)
+{
+	struct mastodon_data *md = ic->proto_data;
+	int delay;
+
+	if (req->data != ic || !req->request || strncmp(req->request, "GET ", 4) != 0 ||
+	    md->retry_attempt >= MASTODON_HTTP_MAX_RETRIES) {
+		return 0;
+	}
+
+	/* mastodon_http() uses other hosts for absolute URLs, and we don't know their port. */
+	char *host = get_rfc822_header(req->request, "Host", 0);
+	gboolean ours = host && g_ascii_strcasecmp(host, md->url_host) == 0;
+	g_free(host);
+	if (!ours) {
+		return 0;
+	}
+
+	delay = retry_after > 0 ? retry_after : 5 << md->retry_attempt;
+	if (delay > MASTODON_HTTP_MAX_RETRY_DELAY) {
+		return 0;
+	}
+
+	struct mastodon_http_retry *r = g_new0(struct mastodon_http_retry, 1);
+	r->ic = ic;
+	r->request = g_strdup(req->request);
+	r->func = req->func;
+	r->attempt = md->retry_attempt + 1;
+	r->timeout = b_timeout_add(delay * 1000, mastodon_http_retry_now, r);
+	md->retries = g_slist_prepend(md->retries, r);
+
+	return delay;
+}
@@ -36,3 +36,5 @@ typedef enum {
 
 struct http_request *mastodon_http(struct im_connection *ic, char *url_string, http_input_function func,
                                   gpointer data, http_method_t method, char** arguments, int arguments_len);
+int mastodon_http_retry(struct im_connection *ic, struct http_request *req, int retry_after);
+void mastodon_http_retry_cancel(struct im_connection *ic);
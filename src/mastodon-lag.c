@@ -0,0 +1,118 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-lag.h"
+#include "mastodon-trace.h"
+
+/**
+ * Once in a while, see how late we are and decide whether to degrade or to recover.
+ */
+static gboolean mastodon_lag_check(gpointer data, gint fd, b_input_condition cond)
+{
+	struct im_connection *ic = data;
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_lag *lag = md->lag;
+	gint64 now = mastodon_trace_clock();
+	gint64 late = MAX(now - lag->expected, 0);
+	gint64 threshold = (gint64) set_getint(&ic->acc->set, "lag_threshold") * 1000000;
+	guint every = 0;
+
+	lag->expected = now + (gint64) MASTODON_LAG_INTERVAL * 1000000;
+	lag->lag = (3 * lag->lag + MAX(late, lag->hold)) / 4;
+	lag->hold = 0;
+
+	if (threshold > 0 && (lag->lag > threshold || (lag->every && lag->lag > threshold / 2))) {
+		gint64 limit;
+		every = 2;
+		for (limit = 2 * threshold; lag->lag > limit && every < MASTODON_LAG_MAX_EVERY; limit *= 2) {
+			every *= 2;
+		}
+	}
+
+	if (every && !lag->every) {
+		mastodon_log(ic, "Bitlbee is lagging by %" G_GINT64_FORMAT " ms: showing only some statuses from the local "
+		             "and federated timelines and from hashtags", lag->lag / 1000000);
+		lag->seen = lag->skipped = 0;
+	} else if (!every && lag->every) {
+		mastodon_log(ic, "Bitlbee caught up: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " statuses from the local "
+		             "and federated timelines and from hashtags were skipped", lag->skipped, lag->seen);
+	}
+	lag->every = every;
+
+	return TRUE;
+}
+
+void mastodon_lag_open(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	md->lag = g_new0(struct mastodon_lag, 1);
+	md->lag->expected = mastodon_trace_clock() + (gint64) MASTODON_LAG_INTERVAL * 1000000;
+	md->lag->timer = b_timeout_add(MASTODON_LAG_INTERVAL, mastodon_lag_check, ic);
+}
+
+void mastodon_lag_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->lag) {
+		b_event_remove(md->lag->timer);
+		g_free(md->lag);
+		md->lag = NULL;
+	}
+}
+
+/**
+ * A stream callback that started at start, from mastodon_trace_clock(), just returned.
+ */
+void mastodon_lag_hold(struct im_connection *ic, gint64 start)
+{
+	struct mastodon_data *md = ic->proto_data;
+	gint64 hold = mastodon_trace_clock() - start;
+
+	if (md->lag) {
+		md->lag->hold = MAX(md->lag->hold, hold);
+		md->lag->max_hold = MAX(md->lag->max_hold, hold);
+	}
+}
+
+/**
+ * Decide whether to skip an update that arrived on a stream, before parsing it.
+ */
+gboolean mastodon_lag_skip(struct im_connection *ic, mastodon_timeline_type_t subscription)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_lag *lag = md->lag;
+
+	if (!lag || !lag->every || subscription == MT_HOME || subscription == MT_LIST) {
+		return FALSE;
+	}
+
+	if (lag->seen++ % lag->every == 0) {
+		return FALSE;
+	}
+	lag->skipped++;
+	lag->skipped_total++;
+	return TRUE;
+}
@@ -0,0 +1,55 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+#include "mastodon-lib.h"
+
+/**
+ * Watching the main loop. Every stream callback is timed, and a timer checks how late it fires. When the smoothed lag
+ * crosses the lag_threshold setting, updates from the local and federated timelines and from hashtags are sampled:
+ * only one in every so many is parsed and shown, and the more lag, the fewer. The home timeline, lists, notifications
+ * and direct messages are always delivered in full. Once the lag is below half the threshold, everything is shown
+ * again and we say how much was skipped.
+ */
+
+#define MASTODON_LAG_INTERVAL 1000 /* milliseconds between timer checks */
+#define MASTODON_LAG_MAX_EVERY 16 /* show at least one in this many updates */
+
+struct mastodon_lag {
+	gint timer;
+	gint64 expected; /* when the timer should fire, from mastodon_trace_clock() */
+	gint64 lag; /* smoothed, in nanoseconds */
+	gint64 hold; /* the longest stream callback since the last check */
+	gint64 max_hold; /* the longest stream callback since connecting */
+	guint every; /* 0 unless degraded; otherwise show one in this many updates of low-priority streams */
+	guint64 seen; /* low-priority updates since degrading */
+	guint64 skipped; /* of these, how many were not shown */
+	guint64 skipped_total;
+};
+
+void mastodon_lag_open(struct im_connection *ic);
+void mastodon_lag_close(struct im_connection *ic);
+void mastodon_lag_hold(struct im_connection *ic, gint64 start);
+gboolean mastodon_lag_skip(struct im_connection *ic, mastodon_timeline_type_t subscription);
@@ -37,6 +37,19 @@
 #include "misc.h"
 #include "base64.h"
 #include "mastodon-lib.h"
+#include "mastodon-arena.h"
+#include "mastodon-text.h"
+#include "mastodon-scan.h"
+#include "mastodon-record.h"
+#include "mastodon-burst.h"
+#include "mastodon-cache.h"
+#include "mastodon-lag.h"
+#include "mastodon-limit.h"
+#include "mastodon-mute.h"
+#include "mastodon-parse.h"
+#include "mastodon-stats.h"
+#include "mastodon-trace.h"
+#include "mastodon-wheel.h"
 #include "oauth2.h"
 #include "json.h"
 #include "json_util.h"
@@ -44,37 +57,42 @@
 #include <ctype.h>
 #include <errno.h>
 
-typedef enum {
-	MT_HOME,
-	MT_LOCAL,
-	MT_FEDERATED,
-	MT_HASHTAG,
-	MT_LIST,
-} mastodon_timeline_type_t;
 
 typedef enum {
 	ML_STATUS,
 	ML_NOTIFICATION,
 } mastodon_list_type_t;
 
+/* The list, its nodes and all the statuses or notifications in it are allocated from the arena. */
 struct mastodon_list {
 	mastodon_list_type_t type;
 	GSList *list;
+	struct mastodon_arena *arena;
 };
 
+/* Accounts are refcounted and shared: there is at most one instance per account id and connection, see
+ * mastodon_xt_get_user(). Statuses, the log and the per-user data all point at the same instance. */
 struct mastodon_account {
 	guint64 id;
 	char *display_name;
 	char *acct;
+	int ref;
+	GHashTable *cache; /* the md->accounts table this account is registered in, if any */
 };
 
+/* Parsing only decodes the fields; the text shown on IRC is built by mastodon_status_render() once we know that the
+ * status is actually going to be shown. */
 struct mastodon_status {
+	struct mastodon_arena *arena; /* the arena the status was parsed into */
 	time_t created_at;
+	gint64 created_at_ms; /* the same in milliseconds, for the delivery latency */
+	gboolean streamed; /* arrived by a stream, so the delivery latency counts */
 	char *spoiler_text;
-	char *spoiler_text_case_folded; /* for filtering */
-	char *text;
+	char *text; /* NULL until rendered */
 	char *content; /* same as text without CW and NSFW prefixes */
-	char *content_case_folded; /* for filtering */
+	gboolean nsfw;
+	GSList *media; /* URLs of attachments not already linked from the content */
+	struct mastodon_status *reblog; /* the status boosted */
 	char *url;
 	struct mastodon_account *account;
 	guint64 id;
@@ -83,20 +101,19 @@ struct mastodon_status {
 	GSList *tags;
 	GSList *mentions;
 	mastodon_timeline_type_t subscription; /* This status was created by a timeline subscription */
+	gboolean server_filtered; /* the instance sent its own filter results, so we don't match locally */
+	GSList *filter_results; /* the struct mastodon_filter_result the instance sent */
+	char *filter_warning; /* title of the filter that matched with the warn action, set when shown */
 	gboolean is_notification; /* This status was created from a notification */
+	mastodon_notification_type_t notification_type; /* of that notification */
 };
 
-typedef enum {
-	MN_MENTION = 1,
-	MN_REBLOG,
-	MN_FAVOURITE,
-	MN_FOLLOW,
-} mastodon_notification_type_t;
-
 struct mastodon_notification {
 	guint64 id;
 	mastodon_notification_type_t type;
 	time_t created_at;
+	gint64 created_at_ms;
+	gboolean streamed;
 	struct mastodon_account *account;
 	struct mastodon_status *status;
 };
@@ -115,14 +132,48 @@ typedef enum {
 	MF_THREAD          = 0x00008,
 } mastodon_filter_type_t;
 
+/* What to do with a status a filter matches. Filters v1 always hide it. Anything we don't know, such as blurring the
+ * media, only warns. */
+typedef enum {
+	MFA_WARN,
+	MFA_HIDE,
+} mastodon_filter_action_t;
+
+/* With Filters v2, a filter has a title and a number of keywords. There is one struct per keyword, and the id is that
+ * of the keyword: the v1 API we use to create and delete filters calls keywords filters. */
 struct mastodon_filter {
 	guint64 id;
 	char* phrase;
 	char* phrase_case_folded;
+	char* title; /* NULL for Filters v1 */
 	mastodon_filter_type_t context;
+	mastodon_filter_action_t action;
 	gboolean irreversible;
 	gboolean whole_word;
 	time_t expires_in;
+	struct mastodon_wheel_timer *expiry; /* removes the filter when it expires */
+};
+
+/* A filter the instance says applies to a status. Allocated from the arena of the status. */
+struct mastodon_filter_result {
+	mastodon_filter_type_t context;
+	mastodon_filter_action_t action;
+	char *title;
+};
+
+/* Case folded text for filtering. Pure ASCII text is not copied: it is folded while matching. */
+struct mastodon_folded {
+	const char *text;
+	gboolean ascii;
+	char *buf; /* owned, unless the text is ASCII */
+};
+
+/* The text of a status filters look at. It is only folded once the first filter applies, see mastodon_filter_fold(). */
+struct mastodon_filter_text {
+	struct mastodon_status *ms;
+	gboolean folded;
+	struct mastodon_folded content;
+	struct mastodon_folded spoiler_text;
 };
 
 struct mastodon_command {
@@ -138,90 +189,106 @@ struct mastodon_command {
 };
 
 /**
- * Frees a mastodon_account struct.
+ * Adds a reference to an account and returns it. This is what you use instead of copying an account. It can be used
+ * with g_slist_copy_deep().
  */
-static void ma_free(struct mastodon_account *ma)
+struct mastodon_account *mastodon_account_ref(struct mastodon_account *ma)
 {
-	if (ma == NULL) {
+	if (ma) {
+		ma->ref++;
+	}
+	return ma;
+}
+
+/**
+ * Drops a reference to an account. The last reference frees the account and removes it from the account cache.
+ */
+void mastodon_account_unref(struct mastodon_account *ma)
+{
+	if (ma == NULL || --ma->ref > 0) {
 		return;
 	}
 
+	if (ma->cache) {
+		g_hash_table_remove(ma->cache, &ma->id);
+	}
 	g_free(ma->display_name);
 	g_free(ma->acct);
 	g_free(ma);
 }
 
 /**
- * Creates a duplicate of an account.
+ * Creates the account cache for a connection. The cache does not own any references: accounts remove themselves when
+ * the last reference is dropped.
  */
-static struct mastodon_account *ma_copy(struct mastodon_account *ma0)
+GHashTable *mastodon_account_cache_new(void)
 {
-	if (ma0 == NULL) {
-		return NULL;
-	}
-
-	struct mastodon_account *ma = g_new0(struct mastodon_account, 1);
-	ma->id = ma0->id;
-	ma->display_name = g_strdup(ma0->display_name);
-	ma->acct = g_strdup(ma0->acct);
-	return ma;
+	return g_hash_table_new(g_int64_hash, g_int64_equal);
 }
 
 /**
- * Frees a mastodon_status struct.
+ * Estimate the memory used by the account cache, for the metrics.
  */
-static void ms_free(struct mastodon_status *ms)
+gsize mastodon_account_cache_bytes(GHashTable *cache)
 {
-	if (ms == NULL) {
-		return;
+	GHashTableIter iter;
+	gpointer value;
+	gsize size = 0;
+
+	g_hash_table_iter_init(&iter, cache);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct mastodon_account *ma = value;
+		size += sizeof(*ma) + 3 * sizeof(gpointer); /* and the hash table entry */
+		size += ma->display_name ? strlen(ma->display_name) + 1 : 0;
+		size += ma->acct ? strlen(ma->acct) + 1 : 0;
 	}
+	return size;
+}
 
-	g_free(ms->spoiler_text);
-	g_free(ms->text);
-	g_free(ms->content);
-	g_free(ms->url);
-	ma_free(ms->account);
-	g_slist_free_full(ms->tags, g_free);
-	g_slist_free_full(ms->mentions, (GDestroyNotify) ma_free);
-	g_free(ms);
+static void mastodon_account_cache_detach(gpointer key, gpointer value, gpointer user_data)
+{
+	struct mastodon_account *ma = value;
+	ma->cache = NULL;
 }
 
 /**
- * Frees a mastodon_notification struct.
+ * Frees the account cache for a connection. Accounts still referenced elsewhere (buddy data is freed after the
+ * connection data, for example) survive and are freed when their last reference goes.
  */
-static void mn_free(struct mastodon_notification *mn)
+void mastodon_account_cache_free(GHashTable *cache)
 {
-	if (mn == NULL) {
+	if (cache == NULL) {
 		return;
 	}
 
-	ma_free(mn->account);
-	ms_free(mn->status);
-	g_free(mn);
+	g_hash_table_foreach(cache, mastodon_account_cache_detach, NULL);
+	g_hash_table_destroy(cache);
 }
 
 /**
- * Free a mastodon_list struct.
- * type is the type of list the struct holds.
+ * Creates an empty mastodon_list struct with its own arena. Statuses and notifications are not freed individually:
+ * they all belong to the arena.
  */
-static void ml_free(struct mastodon_list *ml)
+static struct mastodon_list *ml_new(mastodon_list_type_t type)
 {
-	GSList *l;
+	struct mastodon_arena *arena = mastodon_arena_new();
+	struct mastodon_list *ml = mastodon_arena_new0(arena, struct mastodon_list);
+	ml->type = type;
+	ml->arena = arena;
+	return ml;
+}
 
+/**
+ * Free a mastodon_list struct, including all the statuses or notifications in it.
+ */
+static void ml_free(struct mastodon_list *ml)
+{
 	if (ml == NULL) {
 		return;
 	}
 
-	for (l = ml->list; l; l = g_slist_next(l)) {
-		if (ml->type == ML_STATUS) {
-			ms_free((struct mastodon_status *) l->data);
-		} else if (ml->type == ML_NOTIFICATION) {
-			mn_free((struct mastodon_notification *) l->data);
-		}
-	}
-
-	g_slist_free(ml->list);
-	g_free(ml);
+	/* ml itself is part of the arena */
+	mastodon_arena_free(ml->arena);
 }
 
 /**
@@ -245,7 +312,10 @@ static void mf_free(struct mastodon_filter *mf)
 	if (mf == NULL) {
 		return;
 	}
+	mastodon_wheel_cancel(mf->expiry);
 	g_free(mf->phrase);
+	g_free(mf->phrase_case_folded);
+	g_free(mf->title);
 	g_free(mf);
 }
 
@@ -312,26 +382,123 @@ static void mastodon_add_buddy(struct im_connection *ic, gint64 id, char *name,
 	}
 }
 
-/* Warning: May return a malloc()ed value, which will be free()d on the next
-   call. Only for short-term use. NOT THREADSAFE!  */
-char *mastodon_parse_error(struct http_request *req)
+/* Error replies are tiny JSON objects; overloaded instances sometimes send big HTML pages instead. Never look further
+ * than this for the error message. */
+#define MASTODON_ERROR_SCAN_LIMIT 4096
+
+/**
+ * Copy the JSON string starting after the opening quote at p into out, decoding escapes, stopping at end. The result
+ * is truncated to size - 1 bytes.
+ */
+static void mastodon_error_string(const char *p, const char *end, char *out, gsize size)
 {
-	static char *ret = NULL;
-	json_value *root, *err;
+	gsize n = 0;
+
+	while (p < end && *p != '"' && n + 4 < size) {
+		if (*p != '\\') {
+			out[n++] = *(p++);
+			continue;
+		}
+		if (++p >= end) {
+			break;
+		}
+		switch (*p) {
+		case 'n': case 'r': case 't':
+			out[n++] = ' ';
+			p++;
+			break;
+		case 'u': {
+			gunichar c = 0;
+			int i;
+			for (i = 1; i <= 4 && p + i < end && g_ascii_isxdigit(p[i]); i++) {
+				c = c * 16 + g_ascii_xdigit_value(p[i]);
+			}
+			if (i <= 4) {
+				goto done;
+			}
+			n += g_unichar_to_utf8(g_unichar_validate(c) ? c : '?', out + n);
+			p += 5;
+			break;
+		}
+		default:
+			/* \" and \\ and \/ stand for themselves. */
+			out[n++] = *(p++);
+			break;
+		}
+	}
+done:
+	out[n] = '\0';
+}
 
-	g_free(ret);
-	ret = NULL;
+/**
+ * Parse the Retry-After header: either a number of seconds or an HTTP date.
+ */
+static int mastodon_retry_after(struct http_request *req)
+{
+	char *value;
+	int ret = -1;
 
-	if (req->body_size > 0) {
-		root = json_parse(req->reply_body, req->body_size);
-		err = json_o_get(root, "error");
-		if (err && err->type == json_string && err->u.string.length) {
-			ret = g_strdup_printf("%s (%s)", req->status_string, err->u.string.ptr);
+	if (!req->reply_headers || !(value = get_rfc822_header(req->reply_headers, "Retry-After", 0))) {
+		return -1;
+	}
+
+	g_strstrip(value);
+	if (g_ascii_isdigit(*value)) {
+		ret = atoi(value);
+	} else {
+		struct tm parsed = {0};
+		if (strptime(value, "%a, %d %b %Y %H:%M:%S", &parsed)) {
+			ret = MAX(0, mktime_utc(&parsed) - time(NULL));
+		}
+	}
+
+	g_free(value);
+	return ret;
+}
+
+/**
+ * Find out what went wrong with a request. The "error" attribute of the reply is found without parsing the reply: it
+ * is only looked for in the first few kilobytes, and only if the reply looks like a JSON object.
+ */
+void mastodon_parse_error(struct http_request *req, struct mastodon_error *err)
+{
+	err->status = req->status_code;
+	err->message[0] = '\0';
+	err->retry_after = mastodon_retry_after(req);
+
+	if (req->body_size <= 0 || !req->reply_body) {
+		return;
+	}
+
+	const char *p = req->reply_body;
+	const char *end = p + MIN(req->body_size, MASTODON_ERROR_SCAN_LIMIT);
+
+	while (p < end && g_ascii_isspace(*p)) {
+		p++;
+	}
+	if (p >= end || *p != '{') {
+		return;
+	}
+
+	/* The key is followed by a colon, which tells it apart from a value "error". */
+	while ((p = g_strstr_len(p, end - p, "\"error\""))) {
+		p += 7;
+		while (p < end && g_ascii_isspace(*p)) {
+			p++;
+		}
+		if (p < end && *p == ':') {
+			break;
 		}
-		json_value_free(root);
+	}
+	if (!p) {
+		return;
 	}
 
-	return ret ? ret : req->status_string;
+	for (p++; p < end && g_ascii_isspace(*p); p++) {
+	}
+	if (p < end && *p == '"') {
+		mastodon_error_string(p + 1, end, err->message, sizeof(err->message));
+	}
 }
 
 /* WATCH OUT: This function might or might not destroy your connection.
@@ -349,7 +516,21 @@ static json_value *mastodon_parse_response(struct im_connection *ic, struct http
 	}
 
 	if (req->status_code != 200) {
-		mastodon_log(ic, "Error: %s returned status code %s", path, mastodon_parse_error(req));
+		struct mastodon_error err;
+		int delay;
+
+		mastodon_parse_error(req, &err);
+
+		if ((err.status == 429 || err.status == 503) &&
+		    (delay = mastodon_http_retry(ic, req, err.retry_after))) {
+			mastodon_log(ic, "Error: %s returned status code %s%s%s%s, trying again in %d seconds", path,
+				     req->status_string, *err.message ? " (" : "", err.message, *err.message ? ")" : "",
+				     delay);
+			return NULL;
+		}
+
+		mastodon_log(ic, "Error: %s returned status code %s%s%s%s", path,
+			     req->status_string, *err.message ? " (" : "", err.message, *err.message ? ")" : "");
 
 		if (!(ic->flags & OPT_LOGGED_IN)) {
 			imc_logout(ic, TRUE);
@@ -358,7 +539,10 @@ static json_value *mastodon_parse_response(struct im_connection *ic, struct http
 	}
 
 	json_value *ret;
-	if ((ret = json_parse(req->reply_body, req->body_size)) == NULL) {
+	gint64 start = mastodon_trace_clock();
+	ret = json_parse(req->reply_body, req->body_size);
+	mastodon_stats_time(ic, MS_PARSE, start);
+	if (ret == NULL) {
 		imcb_error(ic, "Error: %s return data that could not be parsed as JSON", path);
 	}
 	return ret;
@@ -388,47 +572,81 @@ static guint64 mastodon_json_int64(const json_value *v)
 static void mastodon_log_object(struct im_connection *ic, json_value *node, int prefix);
 static void mastodon_log_array(struct im_connection *ic, json_value *node, int prefix);
 
-struct mastodon_account *mastodon_xt_get_user(const json_value *node)
+/**
+ * Function to get the mastodon_account struct for an account. If we already know the account, we return the existing
+ * instance, updated if necessary. The reference returned is owned by the arena. If arena is NULL, the caller must drop
+ * it using mastodon_account_unref().
+ */
+struct mastodon_account *mastodon_xt_get_user(struct im_connection *ic, struct mastodon_arena *arena,
+					      const json_value *node)
 {
+	struct mastodon_data *md = ic->proto_data;
 	struct mastodon_account *ma;
 	json_value *jv;
+	guint64 id;
 
-	ma = g_new0(struct mastodon_account, 1);
-	ma->display_name = g_strdup(json_o_str(node, "display_name"));
-	ma->acct = g_strdup(json_o_str(node, "acct"));
+	if (!(jv = json_o_get(node, "id")) ||
+	    !(id = mastodon_json_int64(jv))) {
+		return NULL;
+	}
 
-	if ((jv = json_o_get(node, "id")) &&
-	    (ma->id = mastodon_json_int64(jv))) {
-		return ma;
+	const char *display_name = json_o_str(node, "display_name");
+	const char *acct = json_o_str(node, "acct");
+
+	if ((ma = g_hash_table_lookup(md->accounts, &id))) {
+		mastodon_stats_count(ic, MS_ACCOUNT_CACHE_HITS);
+		mastodon_account_ref(ma);
+		/* People do change their display names, and accounts can move. */
+		if (g_strcmp0(ma->display_name, display_name) != 0) {
+			g_free(ma->display_name);
+			ma->display_name = g_strdup(display_name);
+		}
+		if (g_strcmp0(ma->acct, acct) != 0) {
+			g_free(ma->acct);
+			ma->acct = g_strdup(acct);
+		}
+	} else {
+		mastodon_stats_count(ic, MS_ACCOUNT_CACHE_MISSES);
+		ma = g_new0(struct mastodon_account, 1);
+		ma->id = id;
+		ma->display_name = g_strdup(display_name);
+		ma->acct = g_strdup(acct);
+		ma->ref = 1;
+		ma->cache = md->accounts;
+		g_hash_table_insert(md->accounts, &ma->id, ma);
 	}
 
-	ma_free(ma);
-	return NULL;
+	mastodon_arena_add_cleanup(arena, (GDestroyNotify) mastodon_account_unref, ma);
+	return ma;
 }
 
-/* This is based on strip_html but in addition to what Bitlbee does, we treat p like br. */
-void mastodon_strip_html(char *in)
+/**
+ * Parse a timestamp such as "2017-08-02T10:45:03.123Z" and return milliseconds since the epoch, or 0 if it cannot be
+ * parsed. Very sensitive to changes to the formatting of this field. :-( Also assumes the timezone used is UTC since C
+ * time handling functions suck.
+ */
+static gint64 mastodon_parse_time(const char *s)
 {
-	char *start = in;
-	char out[strlen(in) + 1];
-	char *s = out;
+	struct tm parsed;
+	const char *rest;
+	int ms = 0;
+	int scale = 100;
 
-	memset(out, 0, sizeof(out));
-
-	while (*in) {
-		if (*in == '<') {
-			if (g_strncasecmp(in + 1, "/p>", 3) == 0) {
-				*(s++) = '\n';
-				in += 4;
-			} else {
-				*(s++) = *(in++);
-			}
-		} else {
-			*(s++) = *(in++);
+	if (!(rest = strptime(s, MASTODON_TIME_FORMAT, &parsed))) {
+		return 0;
+	}
+	if (*rest == '.') {
+		for (rest++; g_ascii_isdigit(*rest) && scale; rest++, scale /= 10) {
+			ms += (*rest - '0') * scale;
 		}
 	}
-	strcpy(start, out);
-	strip_html(start);
+	return (gint64) mktime_utc(&parsed) * 1000 + ms;
+}
+
+/* Convert HTML to text in place. See mastodon_html_to_text(). */
+void mastodon_strip_html(char *in)
+{
+	mastodon_html_to_text(in, in);
 }
 
 mastodon_visibility_t mastodon_parse_visibility(char *value)
@@ -524,10 +742,49 @@ void mastodon_with_named_list(struct im_connection *ic, struct mastodon_command
 	mastodon_http(ic, MASTODON_LIST_URL, func, mc, HTTP_GET, NULL, 0);
 }
 
+mastodon_filter_type_t mastodon_parse_context(json_value *parsed);
+
+/**
+ * Parse the filter_action attribute of a Filters v2 filter.
+ */
+static mastodon_filter_action_t mastodon_parse_filter_action(const char *action)
+{
+	return action && strcmp(action, "hide") == 0 ? MFA_HIDE : MFA_WARN;
+}
+
+/**
+ * Parse the filtered attribute of a status: the filters of the user that the instance found to match. These come with
+ * their contexts and the status only counts as filtered in those, so this only collects them.
+ */
+static GSList *mastodon_xt_get_filter_results(struct mastodon_arena *arena, const json_value *node)
+{
+	GSList *l = NULL;
+	int i;
+	for (i = 0; i < node->u.array.length; i++) {
+		json_value *result = node->u.array.values[i];
+		json_value *filter, *context;
+		if (result->type != json_object ||
+			!(filter = json_o_get(result, "filter")) || filter->type != json_object) {
+			continue;
+		}
+		struct mastodon_filter_result *mfr = mastodon_arena_new0(arena, struct mastodon_filter_result);
+		if ((context = json_o_get(filter, "context")) && context->type == json_array) {
+			mfr->context = mastodon_parse_context(context);
+		}
+		mfr->action = mastodon_parse_filter_action(json_o_str(filter, "filter_action"));
+		const char *title = json_o_str(filter, "title");
+		mfr->title = mastodon_arena_strdup(arena, title ? title : "");
+		l = mastodon_arena_slist_prepend(arena, l, mfr);
+	}
+	return l;
+}
+
 /**
- * Function to fill a mastodon_status struct.
+ * Function to fill a mastodon_status struct. Everything is allocated from the arena, which must not be NULL. If this
+ * returns NULL, the partially parsed status is freed together with the arena.
  */
-static struct mastodon_status *mastodon_xt_get_status(const json_value *node, struct im_connection *ic)
+static struct mastodon_status *mastodon_xt_get_status(struct mastodon_arena *arena, const json_value *node,
+						      struct im_connection *ic)
 {
 	struct mastodon_status *ms = {0};
 	const json_value *rt = NULL;
@@ -535,13 +792,12 @@ static struct mastodon_status *mastodon_xt_get_status(const json_value *node, st
 	const json_value *spoiler_value = NULL;
 	const json_value *url_value = NULL;
 	GSList *media = NULL;
-	gboolean nsfw = FALSE;
-	gboolean use_cw1 = g_strcasecmp(set_getstr(&ic->acc->set, "hide_sensitive"), "advanced_rot13") == 0;
 
 	if (node->type != json_object) {
 		return FALSE;
 	}
-	ms = g_new0(struct mastodon_status, 1);
+	ms = mastodon_arena_new0(arena, struct mastodon_status);
+	ms->arena = arena;
 
 	JSON_O_FOREACH(node, k, v) {
 		if (strcmp("content", k) == 0 && v->type == json_string && *v->u.string.ptr) {
@@ -553,18 +809,12 @@ static struct mastodon_status *mastodon_xt_get_status(const json_value *node, st
 		} else if (strcmp("reblog", k) == 0 && v->type == json_object) {
 			rt = v;
 		} else if (strcmp("created_at", k) == 0 && v->type == json_string) {
-			struct tm parsed;
-
-			/* Very sensitive to changes to the formatting of
-			   this field. :-( Also assumes the timezone used
-			   is UTC since C time handling functions suck. */
-			if (strptime(v->u.string.ptr, MASTODON_TIME_FORMAT, &parsed) != NULL) {
-				ms->created_at = mktime_utc(&parsed);
-			}
+			ms->created_at_ms = mastodon_parse_time(v->u.string.ptr);
+			ms->created_at = ms->created_at_ms / 1000;
 		} else if (strcmp("visibility", k) == 0 && v->type == json_string && *v->u.string.ptr) {
 			ms->visibility = mastodon_parse_visibility(v->u.string.ptr);
 		} else if (strcmp("account", k) == 0 && v->type == json_object) {
-			ms->account = mastodon_xt_get_user(v);
+			ms->account = mastodon_xt_get_user(ic, arena, v);
 		} else if (strcmp("id", k) == 0) {
 			ms->id = mastodon_json_int64(v);
 		} else if (strcmp("in_reply_to_id", k) == 0) {
@@ -577,7 +827,7 @@ static struct mastodon_status *mastodon_xt_get_status(const json_value *node, st
 				if (tag->type == json_object) {
 					const char *name = json_o_str(tag, "name");
 					if (name) {
-						l = g_slist_prepend(l, g_strdup(name));
+						l = mastodon_arena_slist_prepend(arena, l, mastodon_arena_strdup(arena, name));
 					}
 				}
 			}
@@ -587,14 +837,18 @@ static struct mastodon_status *mastodon_xt_get_status(const json_value *node, st
 			int i;
 			gint64 id = set_getint(&ic->acc->set, "account_id");
 			for (i = 0; i < v->u.array.length; i++) {
-				struct mastodon_account *ma = mastodon_xt_get_user(v->u.array.values[i]);
+				struct mastodon_account *ma = mastodon_xt_get_user(ic, arena, v->u.array.values[i]);
 				/* Skip the current user in mentions since we're only interested in this information for replies where
 				 * we'll never want to mention ourselves. */
-				if (ma && ma->id != id) l = g_slist_prepend(l, ma);
+				if (ma && ma->id != id) l = mastodon_arena_slist_prepend(arena, l, ma);
 			}
 			ms->mentions = l;
+		} else if (strcmp("filtered", k) == 0 && v->type == json_array) {
+			/* Mastodon 4 and newer: even an empty array means that the filters were checked. */
+			ms->server_filtered = TRUE;
+			ms->filter_results = mastodon_xt_get_filter_results(arena, v);
 		} else if (strcmp("sensitive", k) == 0 && v->type == json_boolean) {
-			nsfw = v->u.boolean;
+			ms->nsfw = v->u.boolean;
 		} else if (strcmp("media_attachments", k) == 0 && v->type == json_array) {
 			int i;
 			for (i = 0; i < v->u.array.length; i++) {
@@ -618,153 +872,201 @@ static struct mastodon_status *mastodon_xt_get_status(const json_value *node, st
 	}
 
 	if (rt) {
-		struct mastodon_status *rms = mastodon_xt_get_status(rt, ic);
+		struct mastodon_status *rms = mastodon_xt_get_status(arena, rt, ic);
 		if (rms) {
-			/* Alternatively, we could free ms and just use rms, but we'd have to overwrite rms->account
-			 * with ms->account, change rms->text, and maybe more. */
-			ms->text = g_strdup_printf("boosted @%s: %s", rms->account->acct, rms->text);
+			/* Alternatively, we could just use rms, but we'd have to overwrite rms->account with ms->account,
+			 * change rms->text, and maybe more. Since both live in the same arena, we can share data freely. */
+			ms->reblog = rms;
 			ms->id = rms->id;
-
-			ms->url = rms->url; // adopt
-			rms->url = NULL;
-
-			g_slist_free_full(ms->tags, g_free);
-			ms->tags = rms->tags; // adopt
-			rms->tags = NULL;
-
-			g_slist_free_full(ms->mentions, (GDestroyNotify) ma_free);
-			ms->mentions = rms->mentions; // adopt
-			rms->mentions = NULL;
+			ms->url = rms->url;
+			ms->tags = rms->tags;
+			ms->mentions = rms->mentions;
+			/* The instance can send results for the boost and for the boosted status; both apply. The nodes of
+			 * both lists are in the arena, so linking them is enough. */
+			ms->server_filtered |= rms->server_filtered;
+			ms->filter_results = g_slist_concat(ms->filter_results, rms->filter_results);
 
 			/* add original author to mentions of boost if not ourselves */
 			gint64 id = set_getint(&ic->acc->set, "account_id");
 			if (rms->account->id != id) {
-				ms->mentions = g_slist_prepend(ms->mentions, rms->account); // adopt
-				rms->account = NULL;
+				ms->mentions = mastodon_arena_slist_prepend(arena, ms->mentions, rms->account);
 			}
-
-			ms_free(rms);
 		}
 	} else if (ms->id) {
 
 		if (url_value) {
-			ms->url = g_strdup(url_value->u.string.ptr);
+			ms->url = mastodon_arena_strdup(arena, url_value->u.string.ptr);
 		}
 
-		// build status text
-		GString *s = g_string_new(NULL);
-
 		if (spoiler_value) {
-			char *spoiler_text  = g_strdup(spoiler_value->u.string.ptr);
+			char *spoiler_text = mastodon_arena_strdup(arena, spoiler_value->u.string.ptr);
 			mastodon_strip_html(spoiler_text);
-			g_string_append_printf(s, "[CW: %s]", spoiler_text);
 			ms->spoiler_text = spoiler_text;
-			ms->spoiler_text_case_folded = g_utf8_casefold(spoiler_text, -1);
-			if (nsfw || !use_cw1) {
-				g_string_append(s, " ");
-			}
-		}
-
-		if (nsfw) {
-			char *sensitive_flag = set_getstr(&ic->acc->set, "sensitive_flag");
-			g_string_append(s, sensitive_flag);
 		}
 
 		if (text_value) {
-			char *text = g_strdup(text_value->u.string.ptr);
-			mastodon_strip_html(text);
-			ms->content = g_strdup(text);
-			ms->content_case_folded = g_utf8_casefold(text, -1);
-			char *fmt = "%s";
-			if (spoiler_value && use_cw1) {
-				char *wrapped = NULL;
-				char **cwed = NULL;
-				rot13(text);
-				// "\001CW1 \001" = 6 bytes, there's also a nick length issue we take into account.
-				// there's also irc_format_timestamp which can add like 28 bytes or something.
-				wrapped = word_wrap(text, IRC_WORD_WRAP - 6 - MAX_NICK_LENGTH - 28);
-				g_free(text);
-				text = wrapped;
-				cwed = g_strsplit(text, "\n", -1); // easier than a regex
-				g_free(text);
-				text = g_strjoinv("\001\n\001CW1 ", cwed); // easier than a replace
-				g_strfreev(cwed);
-				fmt = "\n\001CW1 %s\001"; // add a newline at the start because that makes word wrap a lot easier (and because it matches the web UI better)
-			} else if (spoiler_value && g_strcasecmp(set_getstr(&ic->acc->set, "hide_sensitive"), "rot13") == 0) {
-				rot13(text);
-			} else if (spoiler_value && set_getbool(&ic->acc->set, "hide_sensitive")) {
-				g_free(text);
-				text = g_strdup(ms->url);
-				if (text) {
-					fmt = "[hidden: %s]";
-				} else {
-					fmt = "[hidden]";
-				}
-			}
-			g_string_append_printf(s, fmt, text);
-			g_free(text);
+			char *content = mastodon_arena_alloc0(arena, text_value->u.string.length + 1);
+			mastodon_html_to_text(content, text_value->u.string.ptr);
+			ms->content = content;
 		}
 
 		GSList *l = NULL;
 		for (l = media; l; l = l->next) {
-			// TODO maybe support hiding media when it's marked NSFW.
-			// (note that only media is hidden when it's marked NSFW. the text still shows.)
-			// (note that we already don't show media, since this is all text, but IRC clients might.)
-
 			char *url = l->data;
-
-			if ((text_value && strstr(text_value->u.string.ptr, url)) || strstr(s->str, url)) {
+			if (!text_value || !strstr(text_value->u.string.ptr, url)) {
 				// skip URLs already in the text
-				continue;
+				ms->media = mastodon_arena_slist_prepend(arena, ms->media, mastodon_arena_strdup(arena, url));
 			}
+		}
+	}
+
+	g_slist_free(media); // elements are pointers into node and don't need to be freed
 
-			if (s->len) {
-				g_string_append(s, " ");
+	if (ms->account && ms->id && (!rt || ms->reblog)) {
+		return ms;
+	}
+
+	return NULL;
+}
+
+/**
+ * Build the text of a status as it is shown on IRC: content warning, sensitive flag, content hidden as the
+ * hide_sensitive setting says, and links to the media attachments.
+ */
+static char *mastodon_status_render_text(struct im_connection *ic, struct mastodon_status *ms)
+{
+	if (ms->reblog) {
+		return mastodon_arena_printf(ms->arena, "boosted @%s: %s", ms->reblog->account->acct,
+					     mastodon_status_render_text(ic, ms->reblog));
+	}
+
+	char *hide_sensitive = set_getstr(&ic->acc->set, "hide_sensitive");
+	gboolean use_cw1 = g_strcasecmp(hide_sensitive, "advanced_rot13") == 0;
+	GString *s = g_string_new(NULL);
+
+	if (ms->spoiler_text) {
+		g_string_append_printf(s, "[CW: %s]", ms->spoiler_text);
+		if (ms->nsfw || !use_cw1) {
+			g_string_append(s, " ");
+		}
+	}
+
+	if (ms->nsfw) {
+		char *sensitive_flag = set_getstr(&ic->acc->set, "sensitive_flag");
+		g_string_append(s, sensitive_flag);
+	}
+
+	if (ms->content) {
+		char *text = g_strdup(ms->content);
+		char *fmt = "%s";
+		if (ms->spoiler_text && use_cw1) {
+			char *wrapped = NULL;
+			char **cwed = NULL;
+			rot13(text);
+			// "\001CW1 \001" = 6 bytes, there's also a nick length issue we take into account.
+			// there's also irc_format_timestamp which can add like 28 bytes or something.
+			wrapped = word_wrap(text, IRC_WORD_WRAP - 6 - MAX_NICK_LENGTH - 28);
+			g_free(text);
+			text = wrapped;
+			cwed = g_strsplit(text, "\n", -1); // easier than a regex
+			g_free(text);
+			text = g_strjoinv("\001\n\001CW1 ", cwed); // easier than a replace
+			g_strfreev(cwed);
+			fmt = "\n\001CW1 %s\001"; // add a newline at the start because that makes word wrap a lot easier (and because it matches the web UI better)
+		} else if (ms->spoiler_text && g_strcasecmp(hide_sensitive, "rot13") == 0) {
+			rot13(text);
+		} else if (ms->spoiler_text && set_getbool(&ic->acc->set, "hide_sensitive")) {
+			g_free(text);
+			text = g_strdup(ms->url);
+			if (text) {
+				fmt = "[hidden: %s]";
+			} else {
+				fmt = "[hidden]";
 			}
-			g_string_append(s, url);
 		}
+		g_string_append_printf(s, fmt, text);
+		g_free(text);
+	}
+
+	GSList *l = NULL;
+	for (l = ms->media; l; l = l->next) {
+		// TODO maybe support hiding media when it's marked NSFW.
+		// (note that only media is hidden when it's marked NSFW. the text still shows.)
+		// (note that we already don't show media, since this is all text, but IRC clients might.)
 
-		ms->text = g_string_free(s, FALSE); // we keep the data
+		char *url = l->data;
 
+		if (strstr(s->str, url)) {
+			// skip URLs already in the text
+			continue;
+		}
+
+		if (s->len) {
+			g_string_append(s, " ");
+		}
+		g_string_append(s, url);
 	}
 
-	g_slist_free(media); // elements are pointers into node and don't need to be freed
+	char *text = mastodon_arena_strndup(ms->arena, s->str, s->len);
+	g_string_free(s, TRUE);
+	return text;
+}
 
-	if (ms->text && ms->account && ms->id) {
-		return ms;
+/**
+ * Render the text of a status for IRC, unless that has already happened, and return it. Statuses made from
+ * notifications get their prefix. The text is allocated from the arena of the status and reused for every channel the
+ * status goes to, so this should only be called once we know that the status is going to be shown.
+ */
+static char *mastodon_status_render(struct im_connection *ic, struct mastodon_status *ms)
+{
+	if (ms->text) {
+		return ms->text;
 	}
 
-	ms_free(ms);
-	return NULL;
+	switch (ms->notification_type) {
+	case MN_REBLOG:
+		ms->text = mastodon_arena_printf(ms->arena, "boosted your status: %s", mastodon_status_render_text(ic, ms));
+		break;
+	case MN_FAVOURITE:
+		ms->text = mastodon_arena_printf(ms->arena, "favourited your status: %s", mastodon_status_render_text(ic, ms));
+		break;
+	case MN_FOLLOW:
+		ms->text = mastodon_arena_printf(ms->arena, "[%s] followed you", ms->account->display_name);
+		break;
+	default:
+		ms->text = mastodon_status_render_text(ic, ms);
+		break;
+	}
+
+	if (ms->filter_warning) {
+		ms->text = mastodon_arena_printf(ms->arena, "[Filtered: %s] %s", ms->filter_warning, ms->text);
+	}
+
+	return ms->text;
 }
 
 /**
- * Function to fill a mastodon_notification struct.
+ * Function to fill a mastodon_notification struct. Everything is allocated from the arena, which must not be NULL.
  */
-static struct mastodon_notification *mastodon_xt_get_notification(const json_value *node, struct im_connection *ic)
+static struct mastodon_notification *mastodon_xt_get_notification(struct mastodon_arena *arena, const json_value *node,
+								  struct im_connection *ic)
 {
 	if (node->type != json_object) {
 		return FALSE;
 	}
 
-	struct mastodon_notification *mn = g_new0(struct mastodon_notification, 1);
+	struct mastodon_notification *mn = mastodon_arena_new0(arena, struct mastodon_notification);
 
 	JSON_O_FOREACH(node, k, v) {
 		if (strcmp("id", k) == 0) {
 			mn->id = mastodon_json_int64(v);
 		} else if (strcmp("created_at", k) == 0 && v->type == json_string) {
-			struct tm parsed;
-
-			/* Very sensitive to changes to the formatting of
-			   this field. :-( Also assumes the timezone used
-			   is UTC since C time handling functions suck. */
-			if (strptime(v->u.string.ptr, MASTODON_TIME_FORMAT, &parsed) != NULL) {
-				mn->created_at = mktime_utc(&parsed);
-			}
+			mn->created_at_ms = mastodon_parse_time(v->u.string.ptr);
+			mn->created_at = mn->created_at_ms / 1000;
 		} else if (strcmp("account", k) == 0 && v->type == json_object) {
-			mn->account = mastodon_xt_get_user(v);
+			mn->account = mastodon_xt_get_user(ic, arena, v);
 		} else if (strcmp("status", k) == 0 && v->type == json_object) {
-			mn->status = mastodon_xt_get_status(v, ic);
+			mn->status = mastodon_xt_get_status(arena, v, ic);
 		} else if (strcmp("type", k) == 0 && v->type == json_string) {
 			if (strcmp(v->u.string.ptr, "mention") == 0) {
 				mn->type = MN_MENTION;
@@ -782,47 +1084,48 @@ static struct mastodon_notification *mastodon_xt_get_notification(const json_val
 		return mn;
 	}
 
-	mn_free(mn);
 	return NULL;
 }
 
+/**
+ * Fill a mastodon_list struct created using ml_new(ML_STATUS).
+ */
 static gboolean mastodon_xt_get_status_list(struct im_connection *ic, const json_value *node,
 					    struct mastodon_list *ml)
 {
-	ml->type = ML_STATUS;
-
 	if (node->type != json_array) {
 		return FALSE;
 	}
 
 	int i;
 	for (i = 0; i < node->u.array.length; i++) {
-		struct mastodon_status *ms = mastodon_xt_get_status(node->u.array.values[i], ic);
+		struct mastodon_status *ms = mastodon_xt_get_status(ml->arena, node->u.array.values[i], ic);
 		if (ms) {
 			/* Code that calls this will display the toots in the home timeline, i.e. the account channel. This is true
 			 * right after a login and when displaying search results or a toot context. */
 			ms->subscription = MT_HOME;
-			ml->list = g_slist_prepend(ml->list, ms);
+			ml->list = mastodon_arena_slist_prepend(ml->arena, ml->list, ms);
 		}
 	}
 	ml->list = g_slist_reverse(ml->list);
 	return TRUE;
 }
 
+/**
+ * Fill a mastodon_list struct created using ml_new(ML_NOTIFICATION).
+ */
 static gboolean mastodon_xt_get_notification_list(struct im_connection *ic, const json_value *node,
 						  struct mastodon_list *ml)
 {
-	ml->type = ML_NOTIFICATION;
-
 	if (node->type != json_array) {
 		return FALSE;
 	}
 
 	int i;
 	for (i = 0; i < node->u.array.length; i++) {
-		struct mastodon_notification *mn = mastodon_xt_get_notification(node->u.array.values[i], ic);
+		struct mastodon_notification *mn = mastodon_xt_get_notification(ml->arena, node->u.array.values[i], ic);
 		if (mn) {
-			ml->list = g_slist_prepend(ml->list, mn);
+			ml->list = mastodon_arena_slist_prepend(ml->arena, ml->list, mn);
 		}
 	}
 	ml->list = g_slist_reverse(ml->list);
@@ -860,8 +1163,8 @@ static char *mastodon_msg_add_id(struct im_connection *ic,
 		md->log[idx].id = ms->id;
 
 		md->log[idx].visibility = ms->visibility;
-		g_slist_free_full(md->log[idx].mentions, g_free);
-		md->log[idx].mentions = g_slist_copy_deep(ms->mentions, (GCopyFunc) ma_copy, NULL);
+		g_slist_free_full(md->log[idx].mentions, (GDestroyNotify) mastodon_account_unref);
+		md->log[idx].mentions = g_slist_copy_deep(ms->mentions, (GCopyFunc) mastodon_account_ref, NULL);
 
 		g_free(md->log[idx].spoiler_text);
 		md->log[idx].spoiler_text = g_strdup(ms->spoiler_text); // no problem if NULL
@@ -891,8 +1194,8 @@ static char *mastodon_msg_add_id(struct im_connection *ic,
 				}
 				mud->last_id = ms->id;
 				mud->last_time = ms->created_at;
-				g_slist_free_full(mud->mentions, (GDestroyNotify) ma_free);
-				mud->mentions = g_slist_copy_deep(ms->mentions, (GCopyFunc) ma_copy, NULL);
+				g_slist_free_full(mud->mentions, (GDestroyNotify) mastodon_account_unref);
+				mud->mentions = g_slist_copy_deep(ms->mentions, (GCopyFunc) mastodon_account_ref, NULL);
 
 				g_free(mud->spoiler_text);
 				mud->spoiler_text = g_strdup(ms->spoiler_text); // no problem if NULL
@@ -944,7 +1247,11 @@ static void mastodon_status_show_chat1(struct im_connection *ic, gboolean me, st
  * attribute gives us a basic hint of how the status wants to be sorted. Now, we also have a TIMELINE command, which
  * allows us to simulate the result. In this case, we can't be sure that appropriate group chats exist and thus we need
  * to put those statuses into the user timeline if they do not. */
-static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_status *status)
+/**
+ * Find the channels a status goes to. By default, that's the main channel. Statuses from list, hashtag and public
+ * timelines go to the channels for them, if there are any. The author becomes a buddy if necessary.
+ */
+static GSList *mastodon_status_chats(struct im_connection *ic, struct mastodon_status *status)
 {
 	gint64 id = set_getint(&ic->acc->set, "account_id");
 	gboolean me = (status->account->id == id);
@@ -954,9 +1261,7 @@ static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_
 		mastodon_add_buddy(ic, status->account->id, status->account->acct, status->account->display_name);
 	}
 
-	char *msg = mastodon_msg_add_id(ic, status, "");
-
-	gboolean seen = FALSE;
+	GSList *chats = NULL;
 	struct mastodon_user_data *mud;
 	struct groupchat *c;
 	bee_user_t *bu;
@@ -972,8 +1277,7 @@ static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_
 			char *title = l->data;
 			struct groupchat *c = bee_chat_by_title(ic->bee, ic, title);
 			if (c) {
-				mastodon_status_show_chat1(ic, me, c, msg, status);
-				seen = TRUE;
+				chats = g_slist_prepend(chats, c);
 			}
 		}
 		break;
@@ -985,8 +1289,7 @@ static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_
 			char *title = g_strdup_printf("#%s", tag);
 			struct groupchat *c = bee_chat_by_title(ic->bee, ic, title);
 			if (c) {
-				mastodon_status_show_chat1(ic, me, c, msg, status);
-				seen = TRUE;
+				chats = g_slist_prepend(chats, c);
 			}
 			g_free(title);
 		}
@@ -996,8 +1299,7 @@ static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_
 		/* If there is an appropriate group chat, do not put it in the user timeline. */
 		c = bee_chat_by_title(ic->bee, ic, "local");
 		if (c) {
-			mastodon_status_show_chat1(ic, me, c, msg, status);
-			seen = TRUE;
+			chats = g_slist_prepend(chats, c);
 		}
 		break;
 
@@ -1005,8 +1307,7 @@ static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_
 		/* If there is an appropriate group chat, do not put it in the user timeline. */
 		c = bee_chat_by_title(ic->bee, ic, "federated");
 		if (c) {
-			mastodon_status_show_chat1(ic, me, c, msg, status);
-			seen = TRUE;
+			chats = g_slist_prepend(chats, c);
 		}
 		break;
 
@@ -1015,11 +1316,56 @@ static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_
 		break;
 	}
 
-	if (!seen) {
-		c = mastodon_groupchat_init(ic);
-		mastodon_status_show_chat1(ic, me, c, msg, status);
+	if (!chats) {
+		chats = g_slist_prepend(chats, mastodon_groupchat_init(ic));
 	}
 
+	return g_slist_reverse(chats);
+}
+
+/**
+ * Drop the channels whose mute rules apply to the status. NULL stands for private messages. Nothing is rendered, yet.
+ */
+static GSList *mastodon_status_unmuted(struct im_connection *ic, struct mastodon_status *ms, GSList *chats)
+{
+	struct mastodon_status *original = ms->reblog ? ms->reblog : ms;
+	struct mastodon_mute_status s = {
+		.acct = ms->account->acct,
+		.boosted_acct = ms->reblog ? ms->reblog->account->acct : NULL,
+		.content = original->content,
+		.spoiler_text = original->spoiler_text,
+		.tags = ms->tags,
+	};
+	GSList *l, *next;
+
+	for (l = chats; l; l = next) {
+		next = l->next;
+		if (mastodon_mute_matches(ic, l->data, &s)) {
+			chats = g_slist_delete_link(chats, l);
+		}
+	}
+	return chats;
+}
+
+/**
+ * Show the status in the channels given, or if there are none, in the channels it goes to. Search results and the
+ * context of a status get here directly, so render it if that hasn't happened, yet.
+ */
+static void mastodon_status_show_chat(struct im_connection *ic, struct mastodon_status *status, GSList *chats)
+{
+	gint64 id = set_getint(&ic->acc->set, "account_id");
+	gboolean me = (status->account->id == id);
+	GSList *all = chats ? NULL : mastodon_status_chats(ic, status);
+	GSList *l;
+
+	mastodon_status_render(ic, status);
+	char *msg = mastodon_msg_add_id(ic, status, "");
+
+	for (l = chats ? chats : all; l; l = l->next) {
+		mastodon_status_show_chat1(ic, me, l->data, msg, status);
+	}
+
+	g_slist_free(all);
 	g_free(msg);
 }
 
@@ -1079,7 +1425,12 @@ static void mastodon_status_show_msg(struct im_connection *ic, struct mastodon_s
 	g_free(text);
 }
 
-struct mastodon_status *mastodon_notification_to_status(struct mastodon_notification *notification)
+/**
+ * Turn a notification into a status we can show. The notification must have been parsed into the same arena. Calling
+ * this twice for the same notification is not supported.
+ */
+struct mastodon_status *mastodon_notification_to_status(struct mastodon_arena *arena,
+							struct mastodon_notification *notification)
 {
 	struct mastodon_account *ma = notification->account;
 	struct mastodon_status *ms = notification->status;
@@ -1089,61 +1440,90 @@ struct mastodon_status *mastodon_notification_to_status(struct mastodon_notifica
 		ma = g_new0(struct mastodon_account, 1);
 		ma->acct = g_strdup("anon");
 		ma->display_name = g_strdup("Unknown");
+		ma->ref = 1;
+		mastodon_arena_add_cleanup(arena, (GDestroyNotify) mastodon_account_unref, ma);
 	}
 
 	/* The status in the notification was written by you, it's account is your account, but now somebody else is doing
 	 * something with it. We want to avoid the extra You at the beginning, "You: [01] @foo boosted your status: bla"
-	 * should be "<foo> [01] boosted your status: bla" or "<foo> followed you". So we're creating a fake status with a
-	 * copy of the notification account. */
+	 * should be "<foo> [01] boosted your status: bla" or "<foo> followed you". So we're creating a fake status with the
+	 * notification account. Everything belongs to the arena, so the account can simply be shared. */
 	if (ms == NULL) {
 		/* Could be a FOLLOW notification without status. */
-		ms = g_new0(struct mastodon_status, 1);
-		ms->account = ma_copy(notification->account);
+		ms = mastodon_arena_new0(arena, struct mastodon_status);
+		ms->arena = arena;
 		ms->created_at = notification->created_at;
-		/* This ensures that ms will be freed when the notification is freed. */
 		notification->status = ms;
-	} else {
-		/* Adopt the account from the notification. The account will be freed when the notification frees the status. */
-		ma_free(ms->account);
-		ms->account = ma;
-		notification->account = NULL;
 	}
+	ms->account = ma;
 
-	/* Make sure filters from the notification context know that this status is from a notification. */
+	/* Make sure filters from the notification context know that this status is from a notification. The prefix such
+	 * as "boosted your status" is added by mastodon_status_render(). */
 	ms->is_notification = TRUE;
+	ms->notification_type = notification->type;
 
-	char *original = ms->text;
+	/* For the delivery latency, what counts is when the notification happened, not when the status was written. */
+	if (notification->streamed) {
+		ms->streamed = TRUE;
+		ms->created_at_ms = notification->created_at_ms;
+	}
 
-	switch (notification->type) {
-	case MN_MENTION:
-		// this is fine
-		original = NULL;
-		break;
-	case MN_REBLOG:
-		ms->text = g_strdup_printf("boosted your status: %s", original);
-		break;
-	case MN_FAVOURITE:
-		ms->text = g_strdup_printf("favourited your status: %s", original);
-		break;
-	case MN_FOLLOW:
-		ms->text = g_strdup_printf("[%s] followed you", ma->display_name);
-		break;
+	return ms;
+}
+
+/**
+ * Fold text for filtering, unless it is pure ASCII.
+ */
+static void mastodon_fold(struct mastodon_folded *f, const char *text)
+{
+	if (!text) {
+		return;
+	}
+	f->ascii = mastodon_text_is_ascii(text);
+	if (f->ascii) {
+		f->text = text;
+	} else {
+		f->text = f->buf = g_utf8_casefold(text, -1);
+	}
+}
+
+/**
+ * Fold the text of the status, the first time a filter needs it.
+ */
+static void mastodon_filter_fold(struct mastodon_filter_text *ft)
+{
+	if (!ft->folded) {
+		mastodon_fold(&ft->content, ft->ms->content);
+		mastodon_fold(&ft->spoiler_text, ft->ms->spoiler_text);
+		ft->folded = TRUE;
 	}
+}
 
-	g_free(original);
+static void mastodon_filter_text_free(struct mastodon_filter_text *ft)
+{
+	g_free(ft->content.buf);
+	g_free(ft->spoiler_text.buf);
+}
 
-	return ms;
+/**
+ * Find the case folded phrase in the folded text.
+ */
+static const char *mastodon_folded_find(const struct mastodon_folded *f, const char *s, const char *phrase)
+{
+	return f->ascii ? mastodon_text_ascii_strcasestr(s, phrase) : strstr(s, phrase);
 }
 
 /**
  * Test whether a filter applies to the text.
  */
-gboolean mastodon_filter_matches_it(char *text, struct mastodon_filter *mf)
+gboolean mastodon_filter_matches_it(const struct mastodon_folded *f, struct mastodon_filter *mf)
 {
+	const char *text = f->text;
+
 	if (!text) return FALSE;
 
 	if (!mf->whole_word) {
-		return strstr(text, mf->phrase_case_folded) != NULL;
+		return mastodon_folded_find(f, text, mf->phrase_case_folded) != NULL;
 	} else {
 		/* Find the character at the beginning of the phrase and the character at the end of the phrase. */
 		int len = strlen(mf->phrase_case_folded);
@@ -1154,8 +1534,8 @@ gboolean mastodon_filter_matches_it(char *text, struct mastodon_filter *mf)
 
 		/* Start searching from the beginning. When we continue searching because a match is not at word boundaries,
 		   just skip a single character because matches can overlap. */
-		gchar *s = text;
-		while ((s = strstr (s, mf->phrase_case_folded))) {
+		const gchar *s = text;
+		while ((s = mastodon_folded_find(f, s, mf->phrase_case_folded))) {
 
 			/* At the beginning of the text counts as a word boundary. If the beginning of the phrase is not
 			 * alphanumeric, we don't care about word boundaries. */
@@ -1190,40 +1570,134 @@ gboolean mastodon_filter_matches_it(char *text, struct mastodon_filter *mf)
 /**
  * Test whether a filter applies to the status.
  */
-gboolean mastodon_filter_matches(struct mastodon_status *ms, struct mastodon_filter *mf)
+gboolean mastodon_filter_matches(struct mastodon_filter_text *ft, struct mastodon_filter *mf)
 {
-	if (!ms || !mf || !mf->phrase_case_folded)
+	if (!ft->ms || !mf || !mf->phrase_case_folded)
 		return FALSE;
-	return (mastodon_filter_matches_it(ms->content_case_folded, mf) ||
-			mastodon_filter_matches_it(ms->spoiler_text_case_folded, mf));
+	mastodon_filter_fold(ft);
+	return (mastodon_filter_matches_it(&ft->content, mf) ||
+			mastodon_filter_matches_it(&ft->spoiler_text, mf));
 }
 
 /**
- * Show the status to the user.
+ * Test whether a filter with this context applies to the status: MF_HOME applies to the home timeline, MF_PUBLIC
+ * applies to the local and federated public timelines, MF_NOTIFICATIONS applies to any notifications received, and
+ * MF_THREAD applies everywhere.
  */
-static void mastodon_status_show(struct im_connection *ic, struct mastodon_status *ms)
+static gboolean mastodon_filter_context_applies(mastodon_filter_type_t context, struct mastodon_status *ms)
 {
-	struct mastodon_data *md = ic->proto_data;
+	return ((context & MF_HOME && ms->subscription == MT_HOME) ||
+		(context & MF_PUBLIC && (ms->subscription == MT_LOCAL || ms->subscription == MT_FEDERATED)) ||
+		(context & MF_NOTIFICATIONS && ms->is_notification) ||
+		context & MF_THREAD);
+}
 
-	if (ms->account == NULL || ms->text == NULL) {
-		return;
+/**
+ * Test whether the filter results the instance sent with the status apply. A filter that hides the status wins over
+ * one that only warns. The action and the title of the filter are returned via action and title.
+ */
+static gboolean mastodon_status_filtered_by_server(struct mastodon_status *ms, mastodon_filter_action_t *action,
+						   char **title)
+{
+	gboolean filtered = FALSE;
+	GSList *l;
+	for (l = ms->filter_results; l; l = g_slist_next(l)) {
+		struct mastodon_filter_result *mfr = (struct mastodon_filter_result *) l->data;
+		if (mastodon_filter_context_applies(mfr->context, ms)) {
+			filtered = TRUE;
+			*action = mfr->action;
+			*title = mfr->title;
+			if (mfr->action == MFA_HIDE) {
+				break;
+			}
+		}
 	}
+	return filtered;
+}
 
-	/* Must check all the filters. */
+/**
+ * Match the filters we loaded against the status, for instances that don't send their own filter results. Must check
+ * all the filters until one hides the status. The text is only folded if one of them applies. The action and the
+ * title of the filter are returned via action and title; the title is copied to the arena of the status. Expired
+ * filters are already gone, see mastodon_filter_expire().
+ */
+static gboolean mastodon_status_filtered_locally(struct mastodon_data *md, struct mastodon_status *ms,
+						 mastodon_filter_action_t *action, char **title)
+{
+	struct mastodon_filter_text ft = { .ms = ms };
+	gboolean filtered = FALSE;
 	GSList *l;
 	for (l = md->filters; l; l = g_slist_next(l)) {
 		struct mastodon_filter *mf = (struct mastodon_filter *) l->data;
-		/* MF_HOME filter applies to the home timeline, MF_PUBLIC applies to the local and federated public timelines,
-		 * MF_NOTIFICATION applies to any notifications received. */
-		if (((mf->context & MF_HOME && ms->subscription == MT_HOME) ||
-			 (mf->context & MF_PUBLIC && (ms->subscription == MT_LOCAL || ms->subscription == MT_FEDERATED)) ||
-			 (mf->context & MF_NOTIFICATIONS && ms->is_notification) ||
-			 mf->context & MF_THREAD) &&
-			mastodon_filter_matches(ms, mf)) {
-			/* Do not show. */
-			return;
+		if ((!filtered || mf->action == MFA_HIDE) &&
+			mastodon_filter_context_applies(mf->context, ms) &&
+			mastodon_filter_matches(&ft, mf)) {
+			filtered = TRUE;
+			*action = mf->action;
+			*title = mastodon_arena_strdup(ms->arena, mf->title ? mf->title : mf->phrase);
+			if (mf->action == MFA_HIDE) {
+				break;
+			}
 		}
 	}
+	mastodon_filter_text_free(&ft);
+	return filtered;
+}
+
+/**
+ * Which delivery latency histogram a status counts for.
+ */
+static mastodon_stats_delivery_t mastodon_status_delivery(struct mastodon_status *ms)
+{
+	if (ms->is_notification) {
+		return MS_NOTIFICATIONS;
+	}
+	switch (ms->subscription) {
+	case MT_LOCAL:
+		return MS_LOCAL;
+	case MT_FEDERATED:
+		return MS_FEDERATED;
+	case MT_HASHTAG:
+		return MS_HASHTAG;
+	case MT_LIST:
+		return MS_LIST;
+	default:
+		return MS_HOME;
+	}
+}
+
+/**
+ * Show the status to the user.
+ */
+static void mastodon_status_show(struct im_connection *ic, struct mastodon_status *ms)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (ms->account == NULL) {
+		return;
+	}
+
+	gint64 start = mastodon_trace_clock();
+	mastodon_filter_action_t action = MFA_WARN;
+	char *title = NULL;
+	gboolean filtered = ms->server_filtered ?
+		mastodon_status_filtered_by_server(ms, &action, &title) :
+		mastodon_status_filtered_locally(md, ms, &action, &title);
+	mastodon_stats_time(ic, MS_FILTER, start);
+	if (filtered && action == MFA_HIDE) {
+		/* Do not show. */
+		mastodon_stats_count(ic, MS_FILTER_HITS);
+		mastodon_trace_event(ic, MTR_DECISION, MTR_INSTANT, ms->id, MTR_FILTERED, 0, NULL);
+		return;
+	}
+
+	/* Show with a warning, if a filter says so. A status that arrived on another stream a moment ago may have been
+	 * rendered with another verdict, see mastodon-cache.h. */
+	char *warning = filtered ? title : NULL;
+	if (ms->text && g_strcmp0(warning, ms->filter_warning) != 0) {
+		ms->text = NULL;
+	}
+	ms->filter_warning = warning;
 
 	/* Deduplicating only affects the previous status shown. Thus, if we got mentioned in a toot by a user that we're
 	 * following, chances are that both events will arrive in sequence. In this case, the second one will be skipped.
@@ -1231,46 +1705,148 @@ static void mastodon_status_show(struct im_connection *ic, struct mastodon_statu
 	 * each other. This will fail if the stream is really busy. Critically, it won't suppress statuses from later
 	 * context and timeline requests. */
 	if (ms->id == md->seen_id) {
+		mastodon_stats_count(ic, MS_DEDUP_HITS);
+		mastodon_trace_event(ic, MTR_DECISION, MTR_INSTANT, ms->id, MTR_DUPLICATE, 0, NULL);
 		return;
 	} else {
 		md->seen_id = ms->id;
 	}
 
-	/* Grrrr. Would like to do this during parsing, but can't access settings from there. */
+	/* By default, everything except direct messages goes into a channel. The local mute rules of these channels apply
+	 * or, for private messages, those of the account. */
+	gboolean chat = md->flags & MASTODON_MODE_CHAT && ms->visibility != MV_DIRECT;
+	GSList *chats = mastodon_status_unmuted(ic, ms, chat ? mastodon_status_chats(ic, ms) : g_slist_prepend(NULL, NULL));
+	if (!chats) {
+		mastodon_stats_count(ic, MS_MUTE_HITS);
+		mastodon_trace_event(ic, MTR_DECISION, MTR_INSTANT, ms->id, MTR_MUTED, 0, NULL);
+		return;
+	}
+
+	/* Only now that we know it's going to be shown, build the text. */
+	mastodon_trace_event(ic, MTR_DECISION, MTR_INSTANT, ms->id, MTR_SHOWN, 0, NULL);
+	start = mastodon_trace_clock();
+	mastodon_status_render(ic, ms);
 	if (set_getbool(&ic->acc->set, "strip_newlines")) {
 		strip_newlines(ms->text);
 	}
 
-	/* By default, everything except direct messages goes into a channel. */
-	if (md->flags & MASTODON_MODE_CHAT &&
-		ms->visibility != MV_DIRECT) {
-		mastodon_status_show_chat(ic, ms);
+	if (chat) {
+		mastodon_status_show_chat(ic, ms, chats);
 	} else {
 		mastodon_status_show_msg(ic, ms);
 	}
+	g_slist_free(chats);
+	mastodon_stats_time(ic, MS_RENDER, start);
+
+	if (ms->streamed && ms->created_at_ms) {
+		mastodon_stats_delivered(ic, mastodon_status_delivery(ms), ms->created_at_ms);
+	}
 }
 
-static void mastodon_notification_show(struct im_connection *ic, struct mastodon_notification *notification)
+/* The notification types the hide_* settings hide, by the names the API uses for them. */
+static const struct {
+	mastodon_notification_type_t type;
+	char *name;
+	const char *setting;
+} mastodon_notification_types[] = {
+	{ MN_MENTION, "mention", "hide_mentions" },
+	{ MN_REBLOG, "reblog", "hide_boosts" },
+	{ MN_FAVOURITE, "favourite", "hide_favourites" },
+	{ MN_FOLLOW, "follow", "hide_follows" },
+};
+
+static gboolean mastodon_notification_hidden(struct im_connection *ic, mastodon_notification_type_t type)
 {
-	gboolean show = TRUE;
+	int i;
+	for (i = 0; i < G_N_ELEMENTS(mastodon_notification_types); i++) {
+		if (mastodon_notification_types[i].type == type) {
+			return set_getbool(&ic->acc->set, mastodon_notification_types[i].setting);
+		}
+	}
+	return FALSE;
+}
 
-	switch (notification->type) {
-	case MN_MENTION:
-		show = !set_getbool(&ic->acc->set, "hide_mentions");
-		break;
-	case MN_REBLOG:
-		show = !set_getbool(&ic->acc->set, "hide_boosts");
-		break;
-	case MN_FAVOURITE:
-		show = !set_getbool(&ic->acc->set, "hide_favourites");
-		break;
-	case MN_FOLLOW:
-		show = !set_getbool(&ic->acc->set, "hide_follows");
-		break;
+/**
+ * Add the exclude_types[] arguments for the hidden notification types to args, so that the instance doesn't send them
+ * at all. Returns the number of strings added; args needs room for eight.
+ */
+static int mastodon_notification_exclusions(struct im_connection *ic, char **args)
+{
+	int i, n = 0;
+	for (i = 0; i < G_N_ELEMENTS(mastodon_notification_types); i++) {
+		if (set_getbool(&ic->acc->set, mastodon_notification_types[i].setting)) {
+			args[n++] = "exclude_types[]";
+			args[n++] = mastodon_notification_types[i].name;
+		}
 	}
+	return n;
+}
+
+/**
+ * Find the type of a notification in the raw data of a stream event, between p and end, without parsing it. The
+ * streaming API cannot exclude notification types. Only the "type" key of the notification object itself counts, not
+ * the ones of the status, the account or their attachments nested in it, and the keys can come in any order, so this
+ * keeps track of the nesting. Mastodon writes the type right after the id, so this rarely looks at much. Returns 0 if
+ * there is no type we know.
+ */
+static mastodon_notification_type_t mastodon_notification_peek_type(const char *p, const char *end)
+{
+	int depth = 0;
+	int i;
 
-	if (show)
-		mastodon_status_show(ic, mastodon_notification_to_status(notification));
+	for (; p < end; p++) {
+		if (*p == '{' || *p == '[') {
+			depth++;
+		} else if (*p == '}' || *p == ']') {
+			depth--;
+		} else if (*p == '"') {
+			const char *s = ++p;
+			for (; p < end && *p != '"'; p++) {
+				if (*p == '\\') {
+					p++;
+				}
+			}
+			if (p >= end) {
+				return 0;
+			}
+			if (depth != 1 || p - s != 4 || strncmp(s, "type", 4) != 0) {
+				continue;
+			}
+
+			/* A key at the top level named type: its value follows the colon. */
+			const char *v = p + 1;
+			while (v < end && g_ascii_isspace(*v)) {
+				v++;
+			}
+			if (v >= end || *v != ':') {
+				continue;
+			}
+			v++;
+			while (v < end && g_ascii_isspace(*v)) {
+				v++;
+			}
+			if (v >= end || *v != '"') {
+				return 0;
+			}
+			v++;
+			for (i = 0; i < G_N_ELEMENTS(mastodon_notification_types); i++) {
+				gsize len = strlen(mastodon_notification_types[i].name);
+				if (v + len < end && strncmp(v, mastodon_notification_types[i].name, len) == 0 && v[len] == '"') {
+					return mastodon_notification_types[i].type;
+				}
+			}
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static void mastodon_notification_show(struct im_connection *ic, struct mastodon_arena *arena,
+				       struct mastodon_notification *notification)
+{
+	/* Instances that ignore exclude_types[] still send these. */
+	if (!mastodon_notification_hidden(ic, notification->type))
+		mastodon_status_show(ic, mastodon_notification_to_status(arena, notification));
 }
 
 /**
@@ -1278,15 +1854,49 @@ static void mastodon_notification_show(struct im_connection *ic, struct mastodon
  */
 static void mastodon_stream_handle_notification(struct im_connection *ic, json_value *parsed, mastodon_timeline_type_t subscription)
 {
-	struct mastodon_notification *mn = mastodon_xt_get_notification(parsed, ic);
+	/* In a burst of favourites or boosts of the same status, just count them, see mastodon-burst.h. Only the type, the
+	 * status id and the account name are needed for that. */
+	const char *type = json_o_str(parsed, "type");
+	if (type && (strcmp(type, "favourite") == 0 || strcmp(type, "reblog") == 0)) {
+		json_value *status = json_o_get(parsed, "status");
+		json_value *id = status ? json_o_get(status, "id") : NULL;
+		json_value *account = json_o_get(parsed, "account");
+		if (id && mastodon_burst_absorb(ic, *type == 'f' ? MN_FAVOURITE : MN_REBLOG, mastodon_json_int64(id),
+						account ? json_o_str(account, "acct") : NULL)) {
+			return;
+		}
+	}
+
+	struct mastodon_arena *arena = mastodon_arena_new();
+	struct mastodon_notification *mn = mastodon_xt_get_notification(arena, parsed, ic);
 	if (mn) {
 		/* A follow notification has no status and thus cannot be assigned a subsription (see mastodon_timeline_type_t).
 		 * But if there is a status associated with the notification, we know where it came from. */
 		if (mn->status)
 			mn->status->subscription = subscription;
-		mastodon_notification_show(ic, mn);
-		mn_free(mn);
+		mn->streamed = TRUE;
+		mastodon_notification_show(ic, arena, mn);
+		/* Only a notification that was actually shown has its text rendered. The summary quotes the status, but
+		 * never what hides behind a content warning, whatever hide_sensitive says. */
+		if (mn->status && mn->status->text) {
+			struct mastodon_status *quoted = mn->status->reblog ? mn->status->reblog : mn->status;
+			mastodon_burst_open(ic, mn->type, mn->status->id, quoted->spoiler_text
+					    ? mastodon_arena_printf(arena, "[CW: %s]", quoted->spoiler_text)
+					    : quoted->content);
+		}
 	}
+	mastodon_arena_free(arena);
+}
+
+/**
+ * Show a status that arrived on a stream. It may have arrived on another stream before, see mastodon-cache.h.
+ */
+static void mastodon_stream_show_update(struct im_connection *ic, struct mastodon_status *ms,
+					mastodon_timeline_type_t subscription)
+{
+	ms->subscription = subscription;
+	ms->streamed = TRUE;
+	mastodon_status_show(ic, ms);
 }
 
 /**
@@ -1294,11 +1904,26 @@ static void mastodon_stream_handle_notification(struct im_connection *ic, json_v
  */
 static void mastodon_stream_handle_update(struct im_connection *ic, json_value *parsed, mastodon_timeline_type_t subscription)
 {
-	struct mastodon_status *ms = mastodon_xt_get_status(parsed, ic);
-	if (ms) {
-		ms->subscription = subscription;
-		mastodon_status_show(ic, ms);
-		ms_free(ms);
+	json_value *it = json_o_get(parsed, "id");
+	guint64 id = it ? mastodon_json_int64(it) : 0;
+	struct mastodon_status *ms;
+
+	/* Parsed on a worker, or the data didn't start with the id: at least don't build the status again. */
+	if (id && (ms = mastodon_status_cache_get(ic, id))) {
+		mastodon_stream_show_update(ic, ms, subscription);
+		return;
+	}
+
+	struct mastodon_arena *arena = mastodon_arena_new();
+	ms = mastodon_xt_get_status(arena, parsed, ic);
+	if (ms && id) {
+		mastodon_status_cache_put(ic, id, arena, ms);
+		mastodon_stream_show_update(ic, ms, subscription);
+	} else {
+		if (ms) {
+			mastodon_stream_show_update(ic, ms, subscription);
+		}
+		mastodon_arena_free(arena);
 	}
 }
 
@@ -1322,8 +1947,8 @@ static void mastodon_stream_handle_delete(struct im_connection *ic, json_value *
 	}
 }
 
-static void mastodon_stream_handle_event(struct im_connection *ic, mastodon_evt_flags_t evt_type,
-					 json_value *parsed, mastodon_timeline_type_t subscription)
+void mastodon_stream_handle_event(struct im_connection *ic, mastodon_evt_flags_t evt_type,
+				  json_value *parsed, mastodon_timeline_type_t subscription)
 {
 	if (evt_type == MASTODON_EVT_UPDATE) {
 		mastodon_stream_handle_update(ic, parsed, subscription);
@@ -1343,15 +1968,23 @@ static void mastodon_http_stream(struct http_request *req, mastodon_timeline_typ
 {
 	struct im_connection *ic = req->data;
 	struct mastodon_data *md = ic->proto_data;
+	mastodon_evt_flags_t evt_type = MASTODON_EVT_UNKNOWN;
+	gboolean failed = FALSE;
 	int len = 0;
 	char *nl;
+	const char *body_end;
 
 	if (!g_slist_find(mastodon_connections, ic)) {
 		return;
 	}
 
+	mastodon_record_stream(ic, req);
+
 	if ((req->flags & HTTPC_EOF) || !req->reply_body) {
 		md->streams = g_slist_remove (md->streams, req);
+		mastodon_stats_stream_closed(ic, req);
+		mastodon_parse_stream_closed(ic, req);
+		mastodon_limit_stream_closed(ic, req);
 		imcb_error(ic, "Stream closed (%s)", req->status_string);
 		imc_logout(ic, TRUE);
 		return;
@@ -1365,12 +1998,14 @@ https://github.com/tootsuite/documentation/blob/master/Using-the-API/Streaming-A
 https://developer.mozilla.org/en-US/docs/Web/API/Server-sent_events/Using_server-sent_events#Event_stream_format
 	*/
 
+	body_end = req->reply_body + req->body_size;
+
 	if (req->reply_body[0] == ':' &&
-	    (nl = strchr(req->reply_body, '\n'))) {
+	    (nl = (char *) mastodon_scan_byte(req->reply_body, body_end, '\n')) != body_end) {
 		// found a comment such as the heartbeat ":thump\n"
 		len = nl - req->reply_body + 1;
 		goto end;
-	} else if (!(nl = strstr(req->reply_body, "\n\n"))) {
+	} else if ((nl = (char *) mastodon_scan_pair(req->reply_body, body_end, '\n')) == body_end) {
 		// wait until we have a complete event
 		return;
 	}
@@ -1380,7 +2015,6 @@ https://developer.mozilla.org/en-US/docs/Web/API/Server-sent_events/Using_server
 
 	if (len > 0) {
 		char *p;
-		mastodon_evt_flags_t evt_type = MASTODON_EVT_UNKNOWN;
 
 		// assuming space after colon
 		if (strncmp(req->reply_body, "event: ", 7) == 0) {
@@ -1397,31 +2031,57 @@ https://developer.mozilla.org/en-US/docs/Web/API/Server-sent_events/Using_server
 			}
 		}
 
-		if (evt_type != MASTODON_EVT_UNKNOWN) {
-
-			GString *data = g_string_new("");
-			char* q;
+		/* Drop updates the channel doesn't want, see mastodon-limit.h, and when lagging, skip some updates of
+		 * low-priority streams, see mastodon-lag.h, before spending any time on them. The same goes for
+		 * notifications of a type we hide. */
+		if (evt_type != MASTODON_EVT_UNKNOWN &&
+		    !(evt_type == MASTODON_EVT_UPDATE &&
+		      (mastodon_limit_skip(ic, req) || mastodon_lag_skip(ic, subscription))) &&
+		    !(evt_type == MASTODON_EVT_NOTIFICATION &&
+		      mastodon_notification_hidden(ic, mastodon_notification_peek_type(p, nl)))) {
+
+			/* An update that just arrived on another stream needs no parsing, see mastodon-cache.h. Unless
+			 * events of this stream are still being parsed on workers, as it would jump the queue. */
+			guint64 id = evt_type == MASTODON_EVT_UPDATE && !mastodon_parse_pending(ic, req) ?
+				mastodon_status_cache_peek_id(p, nl) : 0;
+			struct mastodon_status *ms = id ? mastodon_status_cache_get(ic, id) : NULL;
+
+			if (ms) {
+				mastodon_stream_show_update(ic, ms, subscription);
+			} else {
+				GString *data = g_string_new("");
+				char* q;
+
+				while (strncmp(p, "data: ", 6) == 0) {
+					p += 6;
+					q = (char *) mastodon_scan_byte(p, nl + 1, '\n');
+					p[q-p] = '\0';
+					g_string_append(data, p);
+					p = q + 1;
+				}
 
-			while (strncmp(p, "data: ", 6) == 0) {
-				p += 6;
-				q = strchr(p, '\n');
-				p[q-p] = '\0';
-				g_string_append(data, p);
-				p = q + 1;
-			}
+				if (!mastodon_parse_submit(ic, req, evt_type, subscription, data)) {
+					gint64 start = mastodon_trace_clock();
+					json_value *parsed = json_parse(data->str, data->len);
+					mastodon_stats_time(ic, MS_PARSE, start);
+					if (parsed) {
+						mastodon_stream_handle_event(ic, evt_type, parsed, subscription);
+						json_value_free(parsed);
+					} else {
+						failed = TRUE;
+					}
 
-			json_value *parsed;
-			if ((parsed = json_parse(data->str, data->len))) {
-				mastodon_stream_handle_event(ic, evt_type, parsed, subscription);
-				json_value_free(parsed);
+					g_string_free(data, TRUE);
+				}
 			}
-
-			g_string_free(data, TRUE);
 		}
 	}
 
 end:
 	http_flush_bytes(req, len);
+	mastodon_record_flush(ic, req, len);
+	mastodon_stats_stream_event(ic, req, evt_type, len, failed);
+	mastodon_trace_event(ic, MTR_STREAM_EVENT, MTR_INSTANT, GPOINTER_TO_SIZE(req), len, evt_type, NULL);
 
 	/* We might have multiple events */
 	if (req->body_size > 0) {
@@ -1429,29 +2089,43 @@ end:
 	}
 }
 
+/**
+ * Call mastodon_http_stream() and note how long it held the main loop, see mastodon-lag.h.
+ */
+static void mastodon_http_stream_timed(struct http_request *req, mastodon_timeline_type_t subscription)
+{
+	struct im_connection *ic = req->data;
+	gint64 start = mastodon_trace_clock();
+
+	mastodon_http_stream(req, subscription);
+	if (g_slist_find(mastodon_connections, ic)) {
+		mastodon_lag_hold(ic, start);
+	}
+}
+
 static void mastodon_http_stream_user(struct http_request *req)
 {
-	mastodon_http_stream(req, MT_HOME);
+	mastodon_http_stream_timed(req, MT_HOME);
 }
 
 static void mastodon_http_stream_hashtag(struct http_request *req)
 {
-	mastodon_http_stream(req, MT_HASHTAG);
+	mastodon_http_stream_timed(req, MT_HASHTAG);
 }
 
 static void mastodon_http_stream_local(struct http_request *req)
 {
-	mastodon_http_stream(req, MT_LOCAL);
+	mastodon_http_stream_timed(req, MT_LOCAL);
 }
 
 static void mastodon_http_stream_federated(struct http_request *req)
 {
-	mastodon_http_stream(req, MT_FEDERATED);
+	mastodon_http_stream_timed(req, MT_FEDERATED);
 }
 
 static void mastodon_http_stream_list(struct http_request *req)
 {
-	mastodon_http_stream(req, MT_LIST);
+	mastodon_http_stream_timed(req, MT_LIST);
 }
 
 /**
@@ -1463,6 +2137,8 @@ void mastodon_stream(struct im_connection *ic, struct http_request *req)
 	if (req) {
 		req->flags |= HTTPC_STREAMING;
 		md->streams = g_slist_prepend(md->streams, req);
+		mastodon_record_streaming(ic, req);
+		mastodon_stats_streaming(ic, req);
 	}
 }
 
@@ -1610,16 +2286,17 @@ static void mastodon_http_timeline(struct http_request *req, mastodon_timeline_t
 	mastodon_handle_header(req, MASTODON_MORE_STATUSES);
 
 	// Show in reverse order!
+	struct mastodon_arena *arena = mastodon_arena_new();
 	int i;
 	for (i = parsed->u.array.length - 1; i >= 0 ; i--) {
 		json_value *node = parsed->u.array.values[i];
-		struct mastodon_status *ms = mastodon_xt_get_status(node, ic);
+		struct mastodon_status *ms = mastodon_xt_get_status(arena, node, ic);
 		if (ms) {
 			ms->subscription = subscription;
 			mastodon_status_show(ic, ms);
-			ms_free(ms);
 		}
 	}
+	mastodon_arena_free(arena);
 finish:
 	json_value_free(parsed);
 }
@@ -1752,7 +2429,8 @@ void mastodon_flush_timeline(struct im_connection *ic)
 	if (notifications && notifications->list) {
 		for (l = notifications->list; l; l = g_slist_next(l)) {
 			// Skip notifications older than the earliest entry in the timeline.
-			struct mastodon_status *ms = mastodon_notification_to_status((struct mastodon_notification *) l->data);
+			struct mastodon_status *ms = mastodon_notification_to_status(notifications->arena,
+										     (struct mastodon_notification *) l->data);
 			if (output && mastodon_compare_elements(ms, output->data) < 0) {
 				continue;
 			}
@@ -1795,7 +2473,7 @@ static void mastodon_http_get_home_timeline(struct http_request *req)
 		return;
 	}
 
-	struct mastodon_list *ml = g_new0(struct mastodon_list, 1);
+	struct mastodon_list *ml = ml_new(ML_STATUS);
 
 	mastodon_xt_get_status_list(ic, parsed, ml);
 	json_value_free(parsed);
@@ -1825,7 +2503,7 @@ static void mastodon_http_get_notifications(struct http_request *req)
 		return;
 	}
 
-	struct mastodon_list *ml = g_new0(struct mastodon_list, 1);
+	struct mastodon_list *ml = ml_new(ML_NOTIFICATION);
 
 	mastodon_xt_get_notification_list(ic, parsed, ml);
 	json_value_free(parsed);
@@ -1860,7 +2538,9 @@ static void mastodon_get_notifications(struct im_connection *ic)
 	md->notifications_obj = NULL;
 	md->flags &= ~MASTODON_GOT_NOTIFICATIONS;
 
-	mastodon_http(ic, MASTODON_NOTIFICATIONS_URL, mastodon_http_get_notifications, ic, HTTP_GET, NULL, 0);
+	char *args[8];
+	int len = mastodon_notification_exclusions(ic, args);
+	mastodon_http(ic, MASTODON_NOTIFICATIONS_URL, mastodon_http_get_notifications, ic, HTTP_GET, args, len);
 }
 
 static void mastodon_get_filters(struct im_connection *ic);
@@ -1907,15 +2587,16 @@ static void mastodon_http_notifications(struct http_request *req)
 	mastodon_handle_header(req, MASTODON_MORE_NOTIFICATIONS);
 
 	// Show in reverse order!
+	struct mastodon_arena *arena = mastodon_arena_new();
 	int i;
 	for (i = parsed->u.array.length - 1; i >= 0 ; i--) {
 		json_value *node = parsed->u.array.values[i];
-		struct mastodon_notification *mn = mastodon_xt_get_notification(node, ic);
+		struct mastodon_notification *mn = mastodon_xt_get_notification(arena, node, ic);
 		if (mn) {
-			mastodon_notification_show(ic, mn);
-			mn_free(mn);
+			mastodon_notification_show(ic, arena, mn);
 		}
 	}
+	mastodon_arena_free(arena);
 finish:
 	json_value_free(parsed);
 }
@@ -1927,7 +2608,9 @@ finish:
  */
 void mastodon_notifications(struct im_connection *ic)
 {
-	mastodon_http(ic, MASTODON_NOTIFICATIONS_URL, mastodon_http_notifications, ic, HTTP_GET, NULL, 0);
+	char *args[8];
+	int len = mastodon_notification_exclusions(ic, args);
+	mastodon_http(ic, MASTODON_NOTIFICATIONS_URL, mastodon_http_notifications, ic, HTTP_GET, args, len);
 }
 
 mastodon_visibility_t mastodon_default_visibility(struct im_connection *ic)
@@ -1976,24 +2659,24 @@ static void mastodon_http_callback(struct http_request *req)
 	struct mastodon_data *md = ic->proto_data;
 	md->last_id = 0;
 
+	struct mastodon_arena *arena = NULL;
 	struct mastodon_status *ms;
 
 	switch (mc->command) {
 	case MC_UNKNOWN:
 		break;
 	case MC_POST:
-		ms = mastodon_xt_get_status(parsed, ic);
+		arena = mastodon_arena_new();
+		ms = mastodon_xt_get_status(arena, parsed, ic);
 		gint64 id = set_getint(&ic->acc->set, "account_id");
 		if (ms && ms->id && ms->account->id == id) {
-			/* we posted this status */
+			/* we posted this status; spoiler text and mentions must outlive the arena */
 			md->last_id = ms->id;
 			md->last_visibility = ms->visibility;
 			g_free(md->last_spoiler_text);
-			md->last_spoiler_text = ms->spoiler_text; // adopt
-			ms->spoiler_text = NULL;
-			g_slist_free_full(md->mentions, (GDestroyNotify) ma_free);
-			md->mentions = ms->mentions; // adopt
-			ms->mentions = NULL;
+			md->last_spoiler_text = g_strdup(ms->spoiler_text);
+			g_slist_free_full(md->mentions, (GDestroyNotify) mastodon_account_unref);
+			md->mentions = g_slist_copy_deep(ms->mentions, (GCopyFunc) mastodon_account_ref, NULL);
 
 			if(md->undo_type == MASTODON_NEW) {
 
@@ -2061,6 +2744,7 @@ static void mastodon_http_callback(struct http_request *req)
 		mc->redo = mc->undo = 0;
 		break;
 	}
+	mastodon_arena_free(arena);
 	mc_free(mc);
 	json_value_free(parsed);
 }
@@ -2377,7 +3061,8 @@ void mastodon_http_status_delete(struct http_request *req)
 	}
 
 	/* Maintain undo/redo list. */
-	struct mastodon_status *ms = mastodon_xt_get_status(parsed, ic);
+	struct mastodon_arena *arena = mastodon_arena_new();
+	struct mastodon_status *ms = mastodon_xt_get_status(arena, parsed, ic);
 	struct mastodon_data *md = ic->proto_data;
 	gint64 id = set_getint(&ic->acc->set, "account_id");
 	if (ms && ms->id && ms->account->id == id) {
@@ -2409,6 +3094,8 @@ void mastodon_http_status_delete(struct http_request *req)
 		mc->undo = todo->str;
 		g_string_free(todo, FALSE); /* data is kept by mc! */
 	}
+	mastodon_arena_free(arena);
+	json_value_free(parsed);
 
 	char *url = g_strdup_printf(MASTODON_STATUS_URL, mc->id);
 	// No need to acknowledge the processing of the delete: we will get notified.
@@ -2470,10 +3157,10 @@ void mastodon_http_report(struct http_request *req)
 		goto finally;
 	}
 
-	struct mastodon_status *ms = mastodon_xt_get_status(parsed, ic);
+	struct mastodon_arena *arena = mastodon_arena_new();
+	struct mastodon_status *ms = mastodon_xt_get_status(arena, parsed, ic);
 	if (ms) {
 		mr->account_id = ms->account->id;
-		ms_free(ms);
 	} else {
 		mastodon_log(ic, "Error: could not fetch toot to report.");
 		goto finish;
@@ -2492,7 +3179,7 @@ void mastodon_http_report(struct http_request *req)
 	g_free(args[1]);
 	g_free(args[3]);
 finish:
-	ms_free(ms);
+	mastodon_arena_free(arena);
 	json_value_free(parsed);
 finally:
 	// The report structure was created by mastodon_report and has
@@ -2574,12 +3261,12 @@ void mastodon_http_search(struct http_request *req)
 	    (v->type == json_array) &&
 	    (v->u.array.length > 0)) {
 		found = TRUE;
-		struct mastodon_list *ml = g_new0(struct mastodon_list, 1);
+		struct mastodon_list *ml = ml_new(ML_STATUS);
 		mastodon_xt_get_status_list(ic, v, ml);
 		GSList *l;
 		for (l = ml->list; l; l = g_slist_next(l)) {
 			struct mastodon_status *s = (struct mastodon_status *) l->data;
-			mastodon_status_show_chat(ic, s);
+			mastodon_status_show_chat(ic, s, NULL);
 		}
 		ml_free(ml);
 	}
@@ -2604,6 +3291,45 @@ void mastodon_search(struct im_connection *ic, char *what)
 	mastodon_http(ic, MASTODON_SEARCH_URL, mastodon_http_search, ic, HTTP_GET, args, 4);
 }
 
+/**
+ * Callback for mastodon_get_instance. Mastodon 3.4 and later tell us the maximum length of a status in the
+ * configuration; Pleroma and the Glitch edition of Mastodon have max_toot_chars. If neither is there, or the request
+ * fails, the message_length setting is used instead.
+ */
+static void mastodon_http_get_instance(struct http_request *req)
+{
+	struct im_connection *ic = req->data;
+	if (!g_slist_find(mastodon_connections, ic)) {
+		return;
+	}
+
+	struct mastodon_data *md = ic->proto_data;
+	json_value *parsed, *it;
+
+	if (req->status_code != 200 ||
+	    !(parsed = json_parse(req->reply_body, req->body_size))) {
+		return;
+	}
+
+	if ((it = json_o_get(parsed, "max_toot_chars")) && it->type == json_integer) {
+		md->max_characters = it->u.integer;
+	} else if ((it = json_o_get(parsed, "configuration")) && it->type == json_object &&
+		   (it = json_o_get(it, "statuses")) && it->type == json_object &&
+		   (it = json_o_get(it, "max_characters")) && it->type == json_integer) {
+		md->max_characters = it->u.integer;
+	}
+
+	json_value_free(parsed);
+}
+
+/**
+ * Get the maximum length of a status from the instance. See mastodon_length_check.
+ */
+void mastodon_get_instance(struct im_connection *ic)
+{
+	mastodon_http(ic, MASTODON_INSTANCE_URL, mastodon_http_get_instance, ic, HTTP_GET, NULL, 0);
+}
+
 /**
  * Show information about the instance.
  */
@@ -2675,7 +3401,7 @@ static void mastodon_http_search_relationship(struct http_request *req)
 		return;
 	}
 
-	struct mastodon_account *ma = mastodon_xt_get_user(parsed);
+	struct mastodon_account *ma = mastodon_xt_get_user(ic, NULL, parsed);
 
 	if (!ma) {
 		mastodon_log(ic, "Couldn't find a matching account.");
@@ -2690,7 +3416,7 @@ static void mastodon_http_search_relationship(struct http_request *req)
 
 	g_free(args[1]);
 finish:
-	ma_free(ma);
+	mastodon_account_unref(ma);
 	json_value_free(parsed);
 }
 
@@ -2747,14 +3473,15 @@ static void mastodon_http_status_show_url(struct http_request *req)
 		return;
 	}
 
-	struct mastodon_status *ms = mastodon_xt_get_status(parsed, ic);
+	struct mastodon_arena *arena = mastodon_arena_new();
+	struct mastodon_status *ms = mastodon_xt_get_status(arena, parsed, ic);
 	if (ms) {
 		mastodon_log(ic, ms->url);
-		ms_free(ms);
 	} else {
 		mastodon_log(ic, "Error: could not fetch toot url.");
 	}
 
+	mastodon_arena_free(arena);
 	json_value_free(parsed);
 }
 
@@ -2830,14 +3557,15 @@ static void mastodon_http_status_show_mentions(struct http_request *req)
 		return;
 	}
 
-	struct mastodon_status *ms = mastodon_xt_get_status(parsed, ic);
+	struct mastodon_arena *arena = mastodon_arena_new();
+	struct mastodon_status *ms = mastodon_xt_get_status(arena, parsed, ic);
 	if (ms) {
 		mastodon_show_mentions(ic, ms->mentions);
-		ms_free(ms);
 	} else {
 		mastodon_log(ic, "Error: could not fetch toot url.");
 	}
 
+	mastodon_arena_free(arena);
 	json_value_free(parsed);
 }
 
@@ -2865,26 +3593,29 @@ void mastodon_flush_context(struct im_connection *ic)
 		return;
 	}
 
-	struct mastodon_status *ms = md->status_obj;
+	struct mastodon_list *ml = md->status_obj;
 	struct mastodon_list *bl = md->context_before_obj;
 	struct mastodon_list *al = md->context_after_obj;
 	GSList *l;
 
-	for (l = bl->list; l; l = g_slist_next(l)) {
+	for (l = bl ? bl->list : NULL; l; l = g_slist_next(l)) {
 		struct mastodon_status *s = (struct mastodon_status *) l->data;
-		mastodon_status_show_chat(ic, s);
+		mastodon_status_show_chat(ic, s, NULL);
 	}
 
-	mastodon_status_show_chat(ic, ms);
+	for (l = ml ? ml->list : NULL; l; l = g_slist_next(l)) {
+		struct mastodon_status *s = (struct mastodon_status *) l->data;
+		mastodon_status_show_chat(ic, s, NULL);
+	}
 
-	for (l = al->list; l; l = g_slist_next(l)) {
+	for (l = al ? al->list : NULL; l; l = g_slist_next(l)) {
 		struct mastodon_status *s = (struct mastodon_status *) l->data;
-		mastodon_status_show_chat(ic, s);
+		mastodon_status_show_chat(ic, s, NULL);
 	}
 
 	ml_free(al);
 	ml_free(bl);
-	ms_free(ms);
+	ml_free(ml);
 
 	md->flags &= ~(MASTODON_GOT_STATUS | MASTODON_GOT_CONTEXT);
 	md->status_obj = md->context_before_obj = md->context_after_obj = NULL;
@@ -2914,19 +3645,18 @@ void mastodon_http_context(struct http_request *req)
 		goto finished;
 	}
 
-	struct mastodon_list *bl = g_new0(struct mastodon_list, 1);
-	struct mastodon_list *al = g_new0(struct mastodon_list, 1);
-
 	json_value *before = json_o_get(parsed, "ancestors");
 	json_value *after  = json_o_get(parsed, "descendants");
 
-	if (before->type == json_array &&
-	    mastodon_xt_get_status_list(ic, before, bl)) {
+	if (before && before->type == json_array) {
+		struct mastodon_list *bl = ml_new(ML_STATUS);
+		mastodon_xt_get_status_list(ic, before, bl);
 		md->context_before_obj = bl;
 	}
 
-	if (after->type == json_array &&
-	    mastodon_xt_get_status_list(ic, after, al)) {
+	if (after && after->type == json_array) {
+		struct mastodon_list *al = ml_new(ML_STATUS);
+		mastodon_xt_get_status_list(ic, after, al);
 		md->context_after_obj = al;
 	}
 finished:
@@ -2958,7 +3688,13 @@ void mastodon_http_context_status(struct http_request *req)
 		goto end;
 	}
 
-	md->status_obj = mastodon_xt_get_status(parsed, ic);
+	/* A list of one, so that the status comes with its arena. */
+	struct mastodon_list *ml = ml_new(ML_STATUS);
+	struct mastodon_status *ms = mastodon_xt_get_status(ml->arena, parsed, ic);
+	if (ms) {
+		ml->list = mastodon_arena_slist_prepend(ml->arena, NULL, ms);
+	}
+	md->status_obj = ml;
 
 	json_value_free(parsed);
 end:
@@ -2978,7 +3714,7 @@ void mastodon_context(struct im_connection *ic, guint64 id)
 {
 	struct mastodon_data *md = ic->proto_data;
 
-	ms_free(md->status_obj);
+	ml_free(md->status_obj);
 	ml_free(md->context_before_obj);
 	ml_free(md->context_after_obj);
 
@@ -3029,7 +3765,7 @@ void mastodon_chained_account(struct http_request *req, mastodon_chained_account
 	}
 
 	// Just use the first one, let's hope these are sorted appropriately!
-	struct mastodon_account *ma = mastodon_xt_get_user(parsed->u.array.values[0]);
+	struct mastodon_account *ma = mastodon_xt_get_user(ic, NULL, parsed->u.array.values[0]);
 
 	if (ma) {
 		func(ic, ma->id);
@@ -3037,7 +3773,7 @@ void mastodon_chained_account(struct http_request *req, mastodon_chained_account
 		mastodon_log(ic, "Couldn't find a matching account.");
 	}
 
-	ma_free(ma);
+	mastodon_account_unref(ma);
 finish:
 	json_value_free(parsed);
 }
@@ -3084,6 +3820,11 @@ void mastodon_more(struct im_connection *ic)
 
 	if (s) {
 		args = g_strsplit (s, "=", -1);
+		/* The link is already encoded, such as the exclude_types%5B%5D of notifications, but mastodon_http() is going
+		 * to encode the arguments again. */
+		for (i = 0; args[i]; i++) {
+			http_decode(args[i]);
+		}
 	}
 
 	switch(md->more_type) {
@@ -3227,7 +3968,7 @@ static void mastodon_http_follow3(struct http_request *req)
 		return;
 	}
 
-	struct mastodon_account *ma = mastodon_xt_get_user(parsed);
+	struct mastodon_account *ma = mastodon_xt_get_user(ic, NULL, parsed);
 
 	if (ma) {
 		mastodon_add_buddy(ic, ma->id, ma->acct, ma->display_name);
@@ -3236,7 +3977,7 @@ static void mastodon_http_follow3(struct http_request *req)
 		mastodon_log(ic, "Couldn't find a matching account.");
 	}
 
-	ma_free(ma);
+	mastodon_account_unref(ma);
 	json_value_free(parsed);
 }
 
@@ -3320,13 +4061,13 @@ static void mastodon_http_follow1(struct http_request *req)
 	}
 
 	// Just use the first one, let's hope these are sorted appropriately!
-	struct mastodon_account *ma = mastodon_xt_get_user(parsed->u.array.values[0]);
+	struct mastodon_account *ma = mastodon_xt_get_user(ic, NULL, parsed->u.array.values[0]);
 
 	if (ma) {
 		char *url = g_strdup_printf(MASTODON_ACCOUNT_FOLLOW_URL, ma->id);
 		mastodon_http(ic, url, mastodon_http_follow2, ic, HTTP_POST, NULL, 0);
 		g_free(url);
-		ma_free(ma);
+		mastodon_account_unref(ma);
 	} else {
 		mastodon_log(ic, "Couldn't find a matching account.");
 	}
@@ -3367,13 +4108,13 @@ static void mastodon_http_following(struct http_request *req)
 	int i;
 	for (i = 0; i < parsed->u.array.length; i++) {
 
-		struct mastodon_account *ma = mastodon_xt_get_user(parsed->u.array.values[i]);
+		struct mastodon_account *ma = mastodon_xt_get_user(ic, NULL, parsed->u.array.values[i]);
 
 		if (ma) {
 			mastodon_add_buddy(ic, ma->id, ma->acct, ma->display_name);
 		}
 
-		ma_free(ma);
+		mastodon_account_unref(ma);
 	}
 
 finish:
@@ -3556,7 +4297,7 @@ void mastodon_http_list_accounts2(struct http_request *req) {
 
 	for (i = 0; i < parsed->u.array.length; i++) {
 
-		struct mastodon_account *ma = mastodon_xt_get_user(parsed->u.array.values[i]);
+		struct mastodon_account *ma = mastodon_xt_get_user(ic, NULL, parsed->u.array.values[i]);
 
 		if (ma) {
 			g_string_append(m, " ");
@@ -3568,7 +4309,7 @@ void mastodon_http_list_accounts2(struct http_request *req) {
 				g_string_append(m, "@");
 				g_string_append(m, ma->acct);
 			}
-			ma_free(ma);
+			mastodon_account_unref(ma);
 		}
 	}
 	mastodon_log(ic, m->str);
@@ -3641,13 +4382,13 @@ void mastodon_http_list_delete2(struct http_request *req) {
 
 		for (i = 0; i < parsed->u.array.length; i++) {
 
-			struct mastodon_account *ma = mastodon_xt_get_user(parsed->u.array.values[i]);
+			struct mastodon_account *ma = mastodon_xt_get_user(ic, NULL, parsed->u.array.values[i]);
 
 			if (ma) {
 				g_string_append(undo, FS);
 				g_string_append_printf(undo, "list add %" G_GINT64_FORMAT " to %s", ma->id, title);
 			}
-			ma_free(ma);
+			mastodon_account_unref(ma);
 		}
 
 		g_free(mc->undo); mc->undo = undo->str; // adopt
@@ -3820,12 +4561,12 @@ static void mastodon_http_list_reload2(struct http_request *req) {
 		struct mastodon_account *ma;
 		bee_user_t *bu;
 		struct mastodon_user_data *mud;
-		if ((ma = mastodon_xt_get_user(parsed->u.array.values[i])) &&
+		if ((ma = mastodon_xt_get_user(ic, NULL, parsed->u.array.values[i])) &&
 			(bu = bee_user_by_handle(ic->bee, ic, ma->acct)) &&
 			(mud = (struct mastodon_user_data*) bu->data)) {
 			mud->lists = g_slist_prepend(mud->lists, g_strdup(mc->str));
-			ma_free(ma);
 		}
+		mastodon_account_unref(ma);
 	}
 
 	mastodon_log(ic, "Membership of %s list reloaded", mc->str);
@@ -3986,11 +4727,117 @@ struct mastodon_filter *mastodon_parse_filter (json_value *parsed)
 			strptime(it->u.string.ptr, MASTODON_TIME_FORMAT, &time) != NULL)
 			mf->expires_in = mktime_utc(&time);
 
+		/* Filters v1 always hide what they match. */
+		mf->action = MFA_HIDE;
+
 		return mf;
 	}
 	return NULL;
 }
 
+/**
+ * Parse a Filters v2 filter and prepend one struct mastodon_filter per keyword to the list.
+ */
+static GSList *mastodon_parse_filter_v2(GSList *list, json_value *parsed)
+{
+	json_value *keywords, *it;
+	if (!parsed || parsed->type != json_object ||
+		!(keywords = json_o_get(parsed, "keywords")) || keywords->type != json_array) {
+		return list;
+	}
+
+	const char *title = json_o_str(parsed, "title");
+	mastodon_filter_type_t context = 0;
+	if ((it = json_o_get(parsed, "context")) && it->type == json_array)
+		context = mastodon_parse_context(it);
+	mastodon_filter_action_t action = mastodon_parse_filter_action(json_o_str(parsed, "filter_action"));
+	time_t expires_at = 0;
+	struct tm time;
+	if ((it = json_o_get(parsed, "expires_at")) && it->type == json_string &&
+		strptime(it->u.string.ptr, MASTODON_TIME_FORMAT, &time) != NULL)
+		expires_at = mktime_utc(&time);
+
+	int i;
+	for (i = 0; i < keywords->u.array.length; i++) {
+		json_value *keyword = keywords->u.array.values[i];
+		guint64 id;
+		const char *phrase;
+		if (keyword->type != json_object ||
+			!(it = json_o_get(keyword, "id")) ||
+			!(id = mastodon_json_int64(it)) ||
+			!(phrase = json_o_str(keyword, "keyword"))) {
+			continue;
+		}
+
+		struct mastodon_filter *mf = g_new0(struct mastodon_filter, 1);
+		mf->id = id;
+		mf->phrase = g_strdup(phrase);
+		mf->phrase_case_folded = g_utf8_casefold(phrase, -1);
+		mf->title = g_strdup(title ? title : phrase);
+		mf->context = context;
+		mf->action = action;
+		mf->expires_in = expires_at;
+		if ((it = json_o_get(keyword, "whole_word")) && it->type == json_boolean)
+			mf->whole_word = it->u.boolean;
+		list = g_slist_prepend(list, mf);
+	}
+	return list;
+}
+
+/**
+ * A filter expired: stop matching it.
+ */
+static void mastodon_filter_expire(struct im_connection *ic, gpointer data)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_filter *mf = data;
+
+	mf->expiry = NULL;
+	md->filters = g_slist_remove(md->filters, mf);
+	mf_free(mf);
+}
+
+/**
+ * Schedule the removal of the filters that expire, unless that already happened.
+ */
+static void mastodon_filters_schedule(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	GSList *l;
+
+	for (l = md->filters; l; l = g_slist_next(l)) {
+		struct mastodon_filter *mf = (struct mastodon_filter *) l->data;
+		if (mf->expires_in && !mf->expiry) {
+			mf->expiry = mastodon_wheel_add(ic, mf->expires_in, mastodon_filter_expire, mf);
+		}
+	}
+}
+
+/**
+ * The URL to load filters from: Filters v2 unless we know that the instance doesn't have them.
+ */
+static char *mastodon_filters_url(struct mastodon_data *md)
+{
+	return md->flags & MASTODON_FILTERS_V1 ? MASTODON_FILTER_URL : MASTODON_FILTER_V2_URL;
+}
+
+/**
+ * Instances older than Mastodon 4 don't know about Filters v2. If this is the reply of such an instance, remember it
+ * and load the filters again using Filters v1. Returns TRUE if this happened.
+ */
+static gboolean mastodon_filters_fallback(struct http_request *req, http_input_function func)
+{
+	struct im_connection *ic = req->data;
+	struct mastodon_data *md = ic->proto_data;
+
+	if (req->status_code == 404 && !(md->flags & MASTODON_FILTERS_V1)) {
+		md->flags |= MASTODON_FILTERS_V1;
+		mastodon_http(ic, MASTODON_FILTER_URL, func, ic, HTTP_GET, NULL, 0);
+		return TRUE;
+	}
+	return FALSE;
+}
+
 /**
  * Callback for loading filters. We need to do this when connecting to the instance, and we want to do it when
  * displaying the filters.
@@ -4027,11 +4874,17 @@ void mastodon_http_filters_load (struct http_request *req)
 
 	for (i = 0; i < parsed->u.array.length; i++) {
 		json_value *it = parsed->u.array.values[i];
-		struct mastodon_filter *mf = mastodon_parse_filter(it);
-		if (mf)
-			md->filters = g_slist_prepend(md->filters, mf);
+		if (it->type == json_object && json_o_get(it, "keywords")) {
+			md->filters = mastodon_parse_filter_v2(md->filters, it);
+		} else {
+			struct mastodon_filter *mf = mastodon_parse_filter(it);
+			if (mf)
+				md->filters = g_slist_prepend(md->filters, mf);
+		}
 	}
 
+	mastodon_filters_schedule(ic);
+
 finish:
 	json_value_free(parsed);
 }
@@ -4042,8 +4895,15 @@ finish:
 void mastodon_http_filters (struct http_request *req)
 {
 	struct im_connection *ic = req->data;
+	if (!g_slist_find(mastodon_connections, ic)) {
+		return;
+	}
 	struct mastodon_data *md = ic->proto_data;
 
+	if (mastodon_filters_fallback(req, mastodon_http_filters)) {
+		return;
+	}
+
 	mastodon_http_filters_load(req);
 
 	if (!md->filters) {
@@ -4068,7 +4928,12 @@ void mastodon_http_filters (struct http_request *req)
 		}
 		if (mf->irreversible) { g_string_append(p, ", server side"); }
 		if (mf->whole_word) { g_string_append(p, ", whole word"); }
-		mastodon_log(ic, "%2d. %s (properties:%s)", i++, mf->phrase, p->str);
+		if (mf->title) { g_string_append(p, mf->action == MFA_HIDE ? ", hide" : ", warn"); }
+		if (mf->title && strcmp(mf->title, mf->phrase) != 0) {
+			mastodon_log(ic, "%2d. %s: %s (properties:%s)", i++, mf->title, mf->phrase, p->str);
+		} else {
+			mastodon_log(ic, "%2d. %s (properties:%s)", i++, mf->phrase, p->str);
+		}
 		g_string_free(p, TRUE);
 	}
 }
@@ -4078,7 +4943,8 @@ void mastodon_http_filters (struct http_request *req)
  */
 void mastodon_filters(struct im_connection *ic)
 {
-	mastodon_http(ic, MASTODON_FILTER_URL, mastodon_http_filters, ic, HTTP_GET, NULL, 0);
+	struct mastodon_data *md = ic->proto_data;
+	mastodon_http(ic, mastodon_filters_url(md), mastodon_http_filters, ic, HTTP_GET, NULL, 0);
 }
 
 /**
@@ -4091,6 +4957,10 @@ void mastodon_http_get_filters (struct http_request *req)
 		return;
 	}
 
+	if (mastodon_filters_fallback(req, mastodon_http_get_filters)) {
+		return;
+	}
+
 	mastodon_http_filters_load(req);
 
 	struct mastodon_data *md = ic->proto_data;
@@ -4107,7 +4977,7 @@ static void mastodon_get_filters(struct im_connection *ic)
 
 	md->flags &= ~MASTODON_GOT_FILTERS;
 
-	mastodon_http(ic, MASTODON_FILTER_URL, mastodon_http_get_filters, ic, HTTP_GET, NULL, 0);
+	mastodon_http(ic, mastodon_filters_url(md), mastodon_http_get_filters, ic, HTTP_GET, NULL, 0);
 }
 
 /**
@@ -4133,6 +5003,7 @@ void mastodon_http_filter_create(struct http_request *req)
 	if (mf) {
 		struct mastodon_data *md = ic->proto_data;
 		md->filters = g_slist_prepend(md->filters, mf);
+		mastodon_filters_schedule(ic);
 		mastodon_log(ic, "Filter created");
 		/* Maintain undo/redo list. */
 		mc->undo = g_strdup_printf("filter delete %" G_GUINT64_FORMAT, mf->id);
@@ -4186,8 +5057,16 @@ void mastodon_http_filter_delete(struct http_request *req)
 
 	if (req->status_code == 200) {
 		struct mastodon_data *md = ic->proto_data;
-		struct mastodon_filter *mf = (struct mastodon_filter *) mc->data;
-		md->filters = g_slist_remove(md->filters, mf);
+		/* The filter may have expired or been reloaded in the meantime, so look it up again. */
+		GSList *l;
+		for (l = md->filters; l; l = g_slist_next(l)) {
+			struct mastodon_filter *mf = (struct mastodon_filter *) l->data;
+			if (mf->id == mc->id) {
+				md->filters = g_slist_delete_link(md->filters, l);
+				mf_free(mf);
+				break;
+			}
+		}
 		mastodon_http_callback_and_ack(req);
 	}
 }
@@ -4225,7 +5104,7 @@ void mastodon_filter_delete(struct im_connection *ic, char *arg)
 
 	struct mastodon_command *mc = g_new0(struct mastodon_command, 1);
 	mc->ic = ic;
-	mc->data = (gpointer *) mf;
+	mc->id = mf->id;
 	if (md->undo_type == MASTODON_NEW) {
 		mc->command = MC_FILTER_DELETE;
 		/* FIXME: more parameters */
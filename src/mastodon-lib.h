@@ -26,10 +26,11 @@
 
 #include "nogaim.h"
 #include "mastodon-http.h"
+#include "json.h"
 
 #define MASTODON_DEFAULT_INSTANCE "https://octodon.social"
 
-// "2017-08-02T10:45:03.000Z" -- but we're ignoring microseconds and UTC timezone
+// "2017-08-02T10:45:03.000Z" -- milliseconds are parsed separately and the UTC timezone is ignored
 #define MASTODON_TIME_FORMAT "%Y-%m-%dT%H:%M:%S"
 
 #define MASTODON_API(version) "/api/v" #version
@@ -85,6 +86,7 @@
 
 #define MASTODON_FILTER_URL MASTODON_API(1) "/filters"
 #define MASTODON_FILTER_DATA_URL MASTODON_API(1) "/filters/%" G_GINT64_FORMAT
+#define MASTODON_FILTER_V2_URL MASTODON_API(2) "/filters"
 
 #define MASTODON_ACCOUNT_RELATIONSHIP_URL MASTODON_API(1) "/accounts/relationships"
 
@@ -95,6 +97,30 @@ typedef enum {
 	MASTODON_EVT_DELETE,
 } mastodon_evt_flags_t;
 
+typedef enum {
+	MT_HOME,
+	MT_LOCAL,
+	MT_FEDERATED,
+	MT_HASHTAG,
+	MT_LIST,
+} mastodon_timeline_type_t;
+
+typedef enum {
+	MN_MENTION = 1,
+	MN_REBLOG,
+	MN_FAVOURITE,
+	MN_FOLLOW,
+} mastodon_notification_type_t;
+
+struct mastodon_account;
+
+struct mastodon_account *mastodon_account_ref(struct mastodon_account *ma);
+void mastodon_account_unref(struct mastodon_account *ma);
+GHashTable *mastodon_account_cache_new(void);
+void mastodon_account_cache_free(GHashTable *cache);
+gsize mastodon_account_cache_bytes(GHashTable *cache);
+void mastodon_stream_handle_event(struct im_connection *ic, mastodon_evt_flags_t evt_type, json_value *parsed,
+                                  mastodon_timeline_type_t subscription);
 void mastodon_register_app(struct im_connection *ic);
 void mastodon_verify_credentials(struct im_connection *ic);
 void mastodon_notifications(struct im_connection *ic);
@@ -122,6 +148,7 @@ void mastodon_report(struct im_connection *ic, guint64 id, char *comment);
 void mastodon_follow(struct im_connection *ic, char *who);
 void mastodon_status_delete(struct im_connection *ic, guint64 id);
 void mastodon_instance(struct im_connection *ic);
+void mastodon_get_instance(struct im_connection *ic);
 void mastodon_account(struct im_connection *ic, guint64 id);
 void mastodon_search_account(struct im_connection *ic, char *who);
 void mastodon_status(struct im_connection *ic, guint64 id);
@@ -0,0 +1,143 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-limit.h"
+#include "mastodon-trace.h"
+
+void mastodon_limit_add_settings(account_t *acc, set_t **head)
+{
+	set_add(head, "sample", "1", set_eval_int, NULL);
+	set_add(head, "rate_limit", "0", set_eval_int, NULL);
+	set_add(head, "rate_burst", "10", set_eval_int, NULL);
+}
+
+void mastodon_limit_free_settings(account_t *acc, set_t **head)
+{
+	set_del(head, "sample");
+	set_del(head, "rate_limit");
+	set_del(head, "rate_burst");
+}
+
+/**
+ * Tell every channel that dropped updates since the last report how many.
+ */
+static gboolean mastodon_limit_report(gpointer data, gint fd, b_input_condition cond)
+{
+	struct im_connection *ic = data;
+	struct mastodon_data *md = ic->proto_data;
+	GSList *l;
+
+	for (l = ic->groupchats; l; l = g_slist_next(l)) {
+		struct groupchat *c = l->data;
+		struct mastodon_limit *limit;
+		if (c->data && (limit = g_hash_table_lookup(md->limits, c->data)) && limit->dropped) {
+			imcb_chat_log(c, "Dropped %u statuses in the last %d s because of the sample, rate_limit and rate_burst "
+			              "settings of this channel (%" G_GUINT64_FORMAT " since joining)",
+			              limit->dropped, MASTODON_LIMIT_REPORT, limit->dropped_total);
+			limit->dropped = 0;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * A channel showing the stream req was joined. Remember its settings, unless they don't limit anything.
+ */
+void mastodon_limit_stream(struct im_connection *ic, struct http_request *req, set_t **sets)
+{
+	struct mastodon_data *md = ic->proto_data;
+	int sample = set_getint(sets, "sample");
+	int rate = set_getint(sets, "rate_limit");
+	int burst = set_getint(sets, "rate_burst");
+
+	if (!req || (sample <= 1 && rate <= 0)) {
+		return;
+	}
+
+	struct mastodon_limit *limit = g_new0(struct mastodon_limit, 1);
+	limit->sample = MAX(sample, 1);
+	limit->rate = MAX(rate, 0);
+	limit->burst = MAX(burst, 1);
+	limit->tokens = limit->burst;
+	limit->last = mastodon_trace_clock();
+
+	if (!md->limits) {
+		md->limits = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+		md->limits_timer = b_timeout_add(MASTODON_LIMIT_REPORT * 1000, mastodon_limit_report, ic);
+	}
+	g_hash_table_insert(md->limits, req, limit);
+}
+
+/**
+ * Decide whether to drop an update that arrived on the stream req, before parsing it.
+ */
+gboolean mastodon_limit_skip(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_limit *limit;
+
+	if (!md->limits || !(limit = g_hash_table_lookup(md->limits, req))) {
+		return FALSE;
+	}
+
+	if (limit->seen++ % limit->sample != 0) {
+		goto drop;
+	}
+
+	if (limit->rate > 0) {
+		gint64 now = mastodon_trace_clock();
+		limit->tokens = MIN(limit->burst, limit->tokens + (now - limit->last) / 1e9 * limit->rate);
+		limit->last = now;
+		if (limit->tokens < 1) {
+			goto drop;
+		}
+		limit->tokens -= 1;
+	}
+	return FALSE;
+
+drop:
+	limit->dropped++;
+	limit->dropped_total++;
+	return TRUE;
+}
+
+void mastodon_limit_stream_closed(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->limits) {
+		g_hash_table_remove(md->limits, req);
+	}
+}
+
+void mastodon_limit_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->limits) {
+		b_event_remove(md->limits_timer);
+		g_hash_table_destroy(md->limits);
+		md->limits = NULL;
+	}
+}
@@ -0,0 +1,54 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+#include "http_client.h"
+
+/**
+ * Rate limits for channels showing a stream, such as #local or #federated. Three channel settings apply: sample shows
+ * only one in so many updates, and rate_limit and rate_burst feed a token bucket that lets rate_burst updates through
+ * at once and rate_limit per second after that. Updates are dropped before they are parsed, since the event type is
+ * all we need to know. Every MASTODON_LIMIT_REPORT seconds, channels that dropped something say how much.
+ */
+
+#define MASTODON_LIMIT_REPORT 60
+
+struct mastodon_limit {
+	guint sample; /* show one in this many, 1 for all */
+	double rate; /* per second, 0 for unlimited */
+	double burst;
+	double tokens;
+	gint64 last; /* when tokens was last updated, from mastodon_trace_clock() */
+	guint64 seen;
+	guint dropped; /* since the last report */
+	guint64 dropped_total;
+};
+
+void mastodon_limit_add_settings(account_t *acc, set_t **head);
+void mastodon_limit_free_settings(account_t *acc, set_t **head);
+void mastodon_limit_stream(struct im_connection *ic, struct http_request *req, set_t **sets);
+gboolean mastodon_limit_skip(struct im_connection *ic, struct http_request *req);
+void mastodon_limit_stream_closed(struct im_connection *ic, struct http_request *req);
+void mastodon_limit_close(struct im_connection *ic);
@@ -0,0 +1,567 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-lib.h"
+#include "mastodon-metrics.h"
+#include "mastodon-stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* A file or socket the metrics of some accounts go to. Only accounts of the same Bitlbee user share one. */
+struct mastodon_metrics_sink {
+	bee_t *bee; /* the user */
+	char *path; /* see mastodon_file_path() */
+	int fd; /* the listening socket, or -1 for a file */
+	gint input; /* event id for the listening socket */
+	GSList *connections; /* of struct im_connection */
+};
+
+static GHashTable *mastodon_metrics_sinks = NULL; /* path → struct mastodon_metrics_sink * */
+static gint mastodon_metrics_timer = 0; /* only while there are files to write */
+
+/* Upper bounds of the Prometheus histogram buckets, in seconds. */
+static const double mastodon_metrics_request_buckets[] = {
+	0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+static const double mastodon_metrics_delivery_buckets[] = {
+	0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300,
+};
+
+/**
+ * Quote a label value.
+ */
+static char *mastodon_metrics_escape(const char *s)
+{
+	GString *out = g_string_new("\"");
+
+	for (; s && *s; s++) {
+		if (*s == '\\' || *s == '"') {
+			g_string_append_c(out, '\\');
+			g_string_append_c(out, *s);
+		} else if (*s == '\n') {
+			g_string_append(out, "\\n");
+		} else {
+			g_string_append_c(out, *s);
+		}
+	}
+	g_string_append_c(out, '"');
+	return g_string_free(out, FALSE);
+}
+
+static void mastodon_metrics_family(GString *out, const char *name, const char *type, const char *help)
+{
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Write a histogram with the given bucket bounds. unit is the number of seconds the values of h are counted in. The
+ * buckets of h don't line up with the bounds, so a value is counted in a bucket only if its whole bucket in h fits.
+ */
+static void mastodon_metrics_histogram(GString *out, const char *name, const char *labels,
+                                       const struct mastodon_histogram *h, double unit, const double *bounds, int n)
+{
+	guint64 count = 0;
+	int i, j = 0;
+
+	for (i = 0; i < n; i++) {
+		for (; j < MASTODON_HISTOGRAM_BUCKETS && mastodon_histogram_upper(j) * unit <= bounds[i]; j++) {
+			count += h->buckets[j];
+		}
+		g_string_append_printf(out, "%s_bucket{%s,le=\"%g\"} %" G_GUINT64_FORMAT "\n", name, labels, bounds[i], count);
+	}
+	g_string_append_printf(out, "%s_bucket{%s,le=\"+Inf\"} %" G_GUINT64_FORMAT "\n", name, labels, h->count);
+	g_string_append_printf(out, "%s_sum{%s} %.6f\n", name, labels, h->sum * unit);
+	g_string_append_printf(out, "%s_count{%s} %" G_GUINT64_FORMAT "\n", name, labels, h->count);
+}
+
+/**
+ * Rough estimate of the memory a connection uses: its own structures, the account cache, and what the streams have
+ * buffered. The statuses themselves are short-lived and not counted.
+ */
+static gsize mastodon_metrics_memory(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_stats *st = md->stats;
+	gsize size = sizeof(struct mastodon_data);
+	GSList *l;
+
+	if (md->log) {
+		size += MASTODON_LOG_LENGTH * sizeof(struct mastodon_log_data);
+	}
+	size += mastodon_account_cache_bytes(md->accounts);
+	size += sizeof(struct mastodon_stats);
+	size += g_hash_table_size(st->endpoints) * sizeof(struct mastodon_endpoint_stats);
+	size += g_hash_table_size(st->streams) * sizeof(struct mastodon_stream_stats);
+	for (l = md->streams; l; l = g_slist_next(l)) {
+		struct http_request *req = l->data;
+		size += req->body_size;
+	}
+	return size;
+}
+
+/**
+ * The metrics of all the connections, labelled by account.
+ */
+static GString *mastodon_metrics_text(GSList *connections)
+{
+	static const char *types[] = { "other", "update", "notification", "delete" };
+	static const char *classes[] = { "failed", "1xx", "2xx", "3xx", "4xx", "5xx" };
+	static const char *times[] = { "parse", "filter", "render" };
+	GString *out = g_string_new("");
+	GPtrArray *accounts = g_ptr_array_new_with_free_func(g_free);
+	GSList *l, *s;
+	guint n;
+	guint i;
+
+	/* Skip connections that are still logging in. */
+	for (l = connections; l; l = g_slist_next(l)) {
+		struct im_connection *ic = l->data;
+		struct mastodon_data *md = ic->proto_data;
+		g_ptr_array_add(accounts, md->stats ? mastodon_metrics_escape(ic->acc->tag ? ic->acc->tag : ic->acc->user)
+		                                    : NULL);
+	}
+
+#define FOREACH_CONNECTION \
+	for (l = connections, n = 0; l; l = g_slist_next(l), n++) \
+		if (g_ptr_array_index(accounts, n))
+#define CONNECTION_DATA \
+	struct im_connection *ic = l->data; \
+	struct mastodon_data *md = ic->proto_data; \
+	struct mastodon_stats *st = md->stats; \
+	const char *account = g_ptr_array_index(accounts, n); \
+	(void) ic; (void) st
+
+	mastodon_metrics_family(out, "mastodon_up_seconds", "gauge", "Time since the account connected.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_up_seconds{account=%s} %.3f\n", account,
+		                       (g_get_monotonic_time() - st->started) / 1e6);
+	}
+
+	mastodon_metrics_family(out, "mastodon_reconnects_total", "counter",
+	                        "How often the account connected again since Bitlbee started.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_reconnects_total{account=%s} %u\n", account, st->reconnects);
+	}
+
+	mastodon_metrics_family(out, "mastodon_stream_events_total", "counter",
+	                        "Events received by stream and type; other counts heartbeats and ignored events.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		for (s = md->streams; s; s = g_slist_next(s)) {
+			struct mastodon_stream_stats *ss = g_hash_table_lookup(st->streams, s->data);
+			if (ss) {
+				char *stream = mastodon_metrics_escape(ss->path);
+				for (i = 0; i < G_N_ELEMENTS(types); i++) {
+					g_string_append_printf(out, "mastodon_stream_events_total{account=%s,stream=%s,type=\"%s\"} %"
+					                       G_GUINT64_FORMAT "\n", account, stream, types[i], ss->events[i]);
+				}
+				g_free(stream);
+			}
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_stream_bytes_total", "counter", "Bytes received by stream.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		for (s = md->streams; s; s = g_slist_next(s)) {
+			struct mastodon_stream_stats *ss = g_hash_table_lookup(st->streams, s->data);
+			if (ss) {
+				char *stream = mastodon_metrics_escape(ss->path);
+				g_string_append_printf(out, "mastodon_stream_bytes_total{account=%s,stream=%s} %" G_GUINT64_FORMAT
+				                       "\n", account, stream, ss->bytes);
+				g_free(stream);
+			}
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_stream_parse_failures_total", "counter",
+	                        "Events whose data could not be parsed, by stream.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		for (s = md->streams; s; s = g_slist_next(s)) {
+			struct mastodon_stream_stats *ss = g_hash_table_lookup(st->streams, s->data);
+			if (ss) {
+				char *stream = mastodon_metrics_escape(ss->path);
+				g_string_append_printf(out, "mastodon_stream_parse_failures_total{account=%s,stream=%s} %"
+				                       G_GUINT64_FORMAT "\n", account, stream, ss->parse_failures);
+				g_free(stream);
+			}
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_stream_buffered_bytes", "gauge",
+	                        "Bytes a stream received but did not handle yet.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		for (s = md->streams; s; s = g_slist_next(s)) {
+			struct http_request *req = s->data;
+			struct mastodon_stream_stats *ss = g_hash_table_lookup(st->streams, req);
+			if (ss) {
+				char *stream = mastodon_metrics_escape(ss->path);
+				g_string_append_printf(out, "mastodon_stream_buffered_bytes{account=%s,stream=%s} %d\n", account,
+				                       stream, req->body_size);
+				g_free(stream);
+			}
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_http_requests_in_flight", "gauge",
+	                        "Requests waiting for a reply, not counting streams.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_http_requests_in_flight{account=%s} %u\n", account, st->in_flight);
+	}
+
+	mastodon_metrics_family(out, "mastodon_http_requests_total", "counter",
+	                        "Replies by endpoint and status class; failed means there was no reply.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, st->endpoints);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			struct mastodon_endpoint_stats *es = value;
+			char *endpoint = mastodon_metrics_escape(es->path);
+			for (i = 0; i < G_N_ELEMENTS(classes); i++) {
+				if (es->status[i]) {
+					g_string_append_printf(out, "mastodon_http_requests_total{account=%s,endpoint=%s,status=\"%s\"} %"
+					                       G_GUINT64_FORMAT "\n", account, endpoint, classes[i], es->status[i]);
+				}
+			}
+			g_free(endpoint);
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_http_request_duration_seconds", "histogram",
+	                        "Time from sending a request until the reply arrived, by endpoint.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, st->endpoints);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			struct mastodon_endpoint_stats *es = value;
+			char *endpoint = mastodon_metrics_escape(es->path);
+			char *labels = g_strdup_printf("account=%s,endpoint=%s", account, endpoint);
+			mastodon_metrics_histogram(out, "mastodon_http_request_duration_seconds", labels, &es->latency, 1e-6,
+			                           mastodon_metrics_request_buckets,
+			                           G_N_ELEMENTS(mastodon_metrics_request_buckets));
+			g_free(labels);
+			g_free(endpoint);
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_delivery_latency_seconds", "histogram",
+	                        "Time from the creation of a status or notification until it was shown, by stream kind.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		for (i = 0; i < MS_DELIVERIES; i++) {
+			char *labels = g_strdup_printf("account=%s,stream=\"%s\"", account, mastodon_stats_deliveries[i]);
+			mastodon_metrics_histogram(out, "mastodon_delivery_latency_seconds", labels, &st->delivery[i], 1e-3,
+			                           mastodon_metrics_delivery_buckets,
+			                           G_N_ELEMENTS(mastodon_metrics_delivery_buckets));
+			g_free(labels);
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_filter_hits_total", "counter", "Statuses hidden by a filter.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_filter_hits_total{account=%s} %" G_GUINT64_FORMAT "\n", account,
+		                       st->counters[MS_FILTER_HITS]);
+	}
+
+	mastodon_metrics_family(out, "mastodon_dedup_hits_total", "counter",
+	                        "Statuses not shown because they had just been shown.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_dedup_hits_total{account=%s} %" G_GUINT64_FORMAT "\n", account,
+		                       st->counters[MS_DEDUP_HITS]);
+	}
+
+	mastodon_metrics_family(out, "mastodon_mute_hits_total", "counter",
+	                        "Statuses not shown because of local mute rules.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_mute_hits_total{account=%s} %" G_GUINT64_FORMAT "\n", account,
+		                       st->counters[MS_MUTE_HITS]);
+	}
+
+	mastodon_metrics_family(out, "mastodon_status_cache_hits_total", "counter",
+	                        "Updates not parsed because the status had just arrived on another stream.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_status_cache_hits_total{account=%s} %" G_GUINT64_FORMAT "\n",
+		                       account, st->counters[MS_STATUS_CACHE_HITS]);
+	}
+
+	mastodon_metrics_family(out, "mastodon_account_cache_lookups_total", "counter",
+	                        "Lookups in the account cache, by result.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_account_cache_lookups_total{account=%s,result=\"hit\"} %"
+		                       G_GUINT64_FORMAT "\n", account, st->counters[MS_ACCOUNT_CACHE_HITS]);
+		g_string_append_printf(out, "mastodon_account_cache_lookups_total{account=%s,result=\"miss\"} %"
+		                       G_GUINT64_FORMAT "\n", account, st->counters[MS_ACCOUNT_CACHE_MISSES]);
+	}
+
+	mastodon_metrics_family(out, "mastodon_cached_accounts", "gauge", "Accounts in the account cache.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_cached_accounts{account=%s} %u\n", account,
+		                       g_hash_table_size(md->accounts));
+	}
+
+	mastodon_metrics_family(out, "mastodon_time_seconds_total", "counter",
+	                        "Time spent handling events and replies, by stage.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		for (i = 0; i < MS_TIMES; i++) {
+			g_string_append_printf(out, "mastodon_time_seconds_total{account=%s,stage=\"%s\"} %.6f\n", account,
+			                       times[i], st->time[i] / 1e9);
+		}
+	}
+
+	mastodon_metrics_family(out, "mastodon_memory_bytes", "gauge",
+	                        "Rough estimate of the memory used by the connection, not counting statuses.");
+	FOREACH_CONNECTION {
+		CONNECTION_DATA;
+		g_string_append_printf(out, "mastodon_memory_bytes{account=%s} %" G_GSIZE_FORMAT "\n", account,
+		                       mastodon_metrics_memory(ic));
+	}
+
+#undef CONNECTION_DATA
+#undef FOREACH_CONNECTION
+
+	g_ptr_array_free(accounts, TRUE);
+	return out;
+}
+
+/**
+ * Write the metrics to a file next to it and rename it, so that readers never see half a file.
+ */
+static void mastodon_metrics_write(struct mastodon_metrics_sink *sink)
+{
+	GString *text = mastodon_metrics_text(sink->connections);
+	char *tmp = g_strconcat(sink->path, ".tmp", NULL);
+	FILE *file = fopen(tmp, "w");
+
+	if (file) {
+		gboolean ok = fwrite(text->str, 1, text->len, file) == text->len;
+		if (fclose(file) == 0 && ok) {
+			rename(tmp, sink->path);
+		} else {
+			unlink(tmp);
+		}
+	}
+
+	g_free(tmp);
+	g_string_free(text, TRUE);
+}
+
+static gboolean mastodon_metrics_tick(gpointer data, gint fd, b_input_condition cond)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, mastodon_metrics_sinks);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct mastodon_metrics_sink *sink = value;
+		if (sink->fd < 0) {
+			mastodon_metrics_write(sink);
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Somebody connected to the socket: answer with the metrics and hang up. The answer is a minimal HTTP reply, so that
+ * curl --unix-socket works, too. The socket doesn't block, so a client that doesn't read gets less.
+ */
+static gboolean mastodon_metrics_accept(gpointer data, gint fd, b_input_condition cond)
+{
+	struct mastodon_metrics_sink *sink = data;
+	int client = accept(fd, NULL, NULL);
+
+	if (client < 0) {
+		return TRUE;
+	}
+
+	fcntl(client, F_SETFL, O_NONBLOCK);
+	GString *text = mastodon_metrics_text(sink->connections);
+	g_string_prepend(text, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n");
+	if (write(client, text->str, text->len) < 0) {
+		/* Nothing to do about it. */
+	}
+	close(client);
+	g_string_free(text, TRUE);
+	return TRUE;
+}
+
+/**
+ * Listen on a UNIX socket. The path is in the user's own directory, where only the plugin makes sockets, so a socket
+ * there is one we left over when Bitlbee stopped, and it is replaced. Anything else is not.
+ */
+static int mastodon_metrics_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid()) {
+			errno = EEXIST;
+			return -1;
+		}
+		unlink(path);
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+/**
+ * Start exporting if the metrics setting says where to. See mastodon_file_path() for where the file or socket goes.
+ */
+void mastodon_metrics_open(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	const char *setting = set_getstr(&ic->acc->set, "metrics");
+	struct mastodon_metrics_sink *sink;
+	gboolean unix_socket;
+	const char *name;
+	char *path;
+
+	if (!setting || !*setting) {
+		return;
+	}
+
+	unix_socket = g_str_has_prefix(setting, "unix:");
+	name = unix_socket ? setting + 5 : setting;
+	if (!(path = mastodon_file_path(ic, name))) {
+		imcb_error(ic, "Cannot export metrics to %s: %s", name, g_strerror(errno));
+		return;
+	}
+
+	if (!mastodon_metrics_sinks) {
+		mastodon_metrics_sinks = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
+	if ((sink = g_hash_table_lookup(mastodon_metrics_sinks, path))) {
+		/* The path has the user's directory in it, but don't count on that for metrics to stay with their user. */
+		if (sink->bee != ic->bee || (sink->fd >= 0) != unix_socket) {
+			imcb_error(ic, "Cannot export metrics to %s: %s", name, g_strerror(EBUSY));
+			g_free(path);
+			return;
+		}
+		g_free(path);
+	} else {
+		sink = g_new0(struct mastodon_metrics_sink, 1);
+		sink->bee = ic->bee;
+		sink->path = path;
+		sink->fd = -1;
+		if (unix_socket) {
+			if ((sink->fd = mastodon_metrics_listen(sink->path)) < 0) {
+				imcb_error(ic, "Cannot export metrics on %s: %s", name, g_strerror(errno));
+				g_free(sink->path);
+				g_free(sink);
+				return;
+			}
+			sink->input = b_input_add(sink->fd, B_EV_IO_READ, mastodon_metrics_accept, sink);
+		} else if (!mastodon_metrics_timer) {
+			mastodon_metrics_timer = b_timeout_add(MASTODON_METRICS_INTERVAL * 1000, mastodon_metrics_tick, NULL);
+		}
+		g_hash_table_insert(mastodon_metrics_sinks, sink->path, sink);
+	}
+
+	sink->connections = g_slist_append(sink->connections, ic);
+	md->metrics = sink;
+}
+
+/**
+ * Stop exporting the metrics of this connection. The last connection using a sink closes it.
+ */
+void mastodon_metrics_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_metrics_sink *sink = md->metrics;
+	GHashTableIter iter;
+	gpointer value;
+	gboolean files = FALSE;
+
+	if (!sink) {
+		return;
+	}
+
+	md->metrics = NULL;
+	sink->connections = g_slist_remove(sink->connections, ic);
+	if (sink->connections) {
+		return;
+	}
+
+	g_hash_table_iter_init(&iter, mastodon_metrics_sinks);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		if (value == sink) {
+			g_hash_table_iter_remove(&iter);
+		} else if (((struct mastodon_metrics_sink *) value)->fd < 0) {
+			files = TRUE;
+		}
+	}
+
+	if (sink->fd >= 0) {
+		b_event_remove(sink->input);
+		close(sink->fd);
+		unlink(sink->path);
+	}
+	g_free(sink->path);
+	g_free(sink);
+
+	if (!files && mastodon_metrics_timer) {
+		b_event_remove(mastodon_metrics_timer);
+		mastodon_metrics_timer = 0;
+	}
+}
@@ -0,0 +1,38 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+
+/**
+ * Export the statistics of mastodon-stats.h in the Prometheus text format. The metrics setting names a file, which is
+ * rewritten every MASTODON_METRICS_INTERVAL seconds, or with the prefix "unix:" a UNIX socket, which answers every
+ * connection with the current metrics. Accounts using the same file or socket share it, and every sample is labelled
+ * with its account. Without the setting, nothing happens at all.
+ */
+
+#define MASTODON_METRICS_INTERVAL 15
+
+void mastodon_metrics_open(struct im_connection *ic);
+void mastodon_metrics_close(struct im_connection *ic);
@@ -0,0 +1,291 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-mute.h"
+#include <string.h>
+
+/**
+ * Test whether a rule is a regular expression, and if so, return its pattern.
+ */
+static char *mastodon_mute_pattern(const char *rule)
+{
+	gsize len = strlen(rule);
+	return len > 2 && rule[0] == '/' && rule[len - 1] == '/' ? g_strndup(rule + 1, len - 2) : NULL;
+}
+
+/**
+ * Test whether a rule can be used. Rules are separated by spaces, so a regular expression with a space in it gets
+ * split, and then one part starts with a slash and the other ends with one. Neither of them makes sense.
+ */
+static gboolean mastodon_mute_rule_ok(const char *rule)
+{
+	gsize len = strlen(rule);
+	return rule[0] == '/' ? len > 2 && rule[len - 1] == '/' : !strchr(rule, '/');
+}
+
+/**
+ * Check the rules of the mute setting before accepting it.
+ */
+char *mastodon_mute_eval(set_t *set, char *value)
+{
+	char **rules = g_strsplit_set(value ? value : "", " \t", -1);
+	char *result = value;
+	int i;
+
+	for (i = 0; rules[i]; i++) {
+		char *pattern = mastodon_mute_pattern(rules[i]);
+		if (!mastodon_mute_rule_ok(rules[i])) {
+			result = SET_INVALID;
+			break;
+		} else if (pattern) {
+			GRegex *regex = g_regex_new(pattern, G_REGEX_CASELESS, 0, NULL);
+			g_free(pattern);
+			if (!regex) {
+				result = SET_INVALID;
+				break;
+			}
+			g_regex_unref(regex);
+		}
+	}
+	g_strfreev(rules);
+	return result;
+}
+
+static void mastodon_mute_clear(struct mastodon_mute *m)
+{
+	g_free(m->rules);
+	m->rules = NULL;
+	g_ptr_array_set_size(m->regexes, 0);
+	g_hash_table_remove_all(m->accts);
+	g_hash_table_remove_all(m->tags);
+	g_hash_table_remove_all(m->domains);
+	g_ptr_array_set_size(m->globs, 0);
+}
+
+static void mastodon_mute_free(struct mastodon_mute *m)
+{
+	mastodon_mute_clear(m);
+	g_hash_table_destroy(m->accts);
+	g_hash_table_destroy(m->tags);
+	g_hash_table_destroy(m->domains);
+	g_ptr_array_free(m->globs, TRUE);
+	g_ptr_array_free(m->regexes, TRUE);
+	g_free(m);
+}
+
+static struct mastodon_mute *mastodon_mute_new(set_t **sets)
+{
+	struct mastodon_mute *m = g_new0(struct mastodon_mute, 1);
+	m->sets = sets;
+	m->accts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	m->tags = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	m->domains = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	m->globs = g_ptr_array_new_with_free_func((GDestroyNotify) g_pattern_spec_free);
+	m->regexes = g_ptr_array_new_with_free_func((GDestroyNotify) g_regex_unref);
+	return m;
+}
+
+/**
+ * Turn the rules into the regular expressions, the hash tables and the patterns. Every regular expression is compiled
+ * on its own: joined into one, a backreference such as \1 would refer to a group of an earlier rule, and a \Q without
+ * \E would swallow all the rules after it.
+ */
+static void mastodon_mute_compile(struct im_connection *ic, struct mastodon_mute *m, const char *value)
+{
+	struct mastodon_data *md = ic->proto_data;
+	char **rules = g_strsplit_set(value, " \t", -1);
+	int i;
+
+	mastodon_mute_clear(m);
+	m->rules = g_strdup(value);
+
+	for (i = 0; rules[i]; i++) {
+		char *rule = rules[i];
+		char *pattern;
+		if (!*rule || !mastodon_mute_rule_ok(rule)) {
+			continue;
+		} else if ((pattern = mastodon_mute_pattern(rule))) {
+			GError *error = NULL;
+			GRegex *regex = g_regex_new(pattern, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0, &error);
+			if (regex) {
+				g_ptr_array_add(m->regexes, regex);
+			} else {
+				mastodon_log(ic, "Cannot use %s of the mute setting: %s", rule, error->message);
+				g_error_free(error);
+			}
+			g_free(pattern);
+		} else if (rule[0] == '#' && rule[1]) {
+			g_hash_table_add(m->tags, g_utf8_casefold(rule + 1, -1));
+		} else if (rule[0] == '@' && rule[1]) {
+			char *full = strchr(rule + 1, '@') ? g_strdup(rule + 1) : g_strdup_printf("%s@%s", rule + 1, md->url_host);
+			char *acct = g_ascii_strdown(full, -1);
+			g_free(full);
+			if (strpbrk(acct, "*?")) {
+				g_ptr_array_add(m->globs, g_pattern_spec_new(acct));
+				g_free(acct);
+			} else {
+				g_hash_table_add(m->accts, acct);
+			}
+		} else {
+			g_hash_table_add(m->domains, g_ascii_strdown(rule, -1));
+		}
+	}
+
+	g_strfreev(rules);
+}
+
+/**
+ * A channel was joined: remember where its settings are.
+ */
+void mastodon_mute_chat(struct im_connection *ic, struct groupchat *c, set_t **sets)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (!md->mutes) {
+		md->mutes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) mastodon_mute_free);
+	}
+	g_hash_table_insert(md->mutes, c, mastodon_mute_new(sets));
+}
+
+void mastodon_mute_chat_closed(struct im_connection *ic, struct groupchat *c)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->mutes) {
+		g_hash_table_remove(md->mutes, c);
+	}
+}
+
+/**
+ * Find the compiled rules for the channel, compiling them if the setting changed. NULL stands for private messages.
+ * Returns NULL if there are no rules.
+ */
+static struct mastodon_mute *mastodon_mute_get(struct im_connection *ic, struct groupchat *c)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_mute *m;
+
+	/* The main channel and private messages share the rules of the account. */
+	if (c == md->timeline_gc) {
+		c = NULL;
+	}
+
+	if (!md->mutes || !(m = g_hash_table_lookup(md->mutes, c))) {
+		if (c) {
+			return NULL;
+		}
+		mastodon_mute_chat(ic, NULL, &ic->acc->set);
+		m = g_hash_table_lookup(md->mutes, NULL);
+	}
+
+	const char *rules = set_getstr(m->sets, "mute");
+	if (!rules || !*rules) {
+		return NULL;
+	}
+	if (!m->rules || strcmp(rules, m->rules) != 0) {
+		mastodon_mute_compile(ic, m, rules);
+	}
+	return m;
+}
+
+/**
+ * Test the account rules: exact accounts, domains and their parent domains, and patterns.
+ */
+static gboolean mastodon_mute_acct(struct im_connection *ic, struct mastodon_mute *m, const char *acct)
+{
+	struct mastodon_data *md = ic->proto_data;
+	gboolean muted = FALSE;
+
+	if (!acct || (!g_hash_table_size(m->accts) && !g_hash_table_size(m->domains) && !m->globs->len)) {
+		return FALSE;
+	}
+
+	/* Local accounts come without the domain. */
+	char *tmp = strchr(acct, '@') ? NULL : g_strdup_printf("%s@%s", acct, md->url_host);
+	char *full = g_ascii_strdown(tmp ? tmp : acct, -1);
+	const char *domain = strchr(full, '@') + 1;
+	g_free(tmp);
+	guint i;
+
+	if (g_hash_table_contains(m->accts, full)) {
+		muted = TRUE;
+	}
+	for (; !muted && domain; domain = strchr(domain, '.') ? strchr(domain, '.') + 1 : NULL) {
+		muted = g_hash_table_contains(m->domains, domain);
+	}
+	for (i = 0; !muted && i < m->globs->len; i++) {
+		muted = g_pattern_match_string(g_ptr_array_index(m->globs, i), full);
+	}
+
+	g_free(full);
+	return muted;
+}
+
+/**
+ * Test whether the rules for the channel mute the status. NULL stands for private messages.
+ */
+gboolean mastodon_mute_matches(struct im_connection *ic, struct groupchat *c, const struct mastodon_mute_status *s)
+{
+	struct mastodon_mute *m = mastodon_mute_get(ic, c);
+	GSList *l;
+	guint i;
+
+	if (!m) {
+		return FALSE;
+	}
+
+	if (mastodon_mute_acct(ic, m, s->acct) || mastodon_mute_acct(ic, m, s->boosted_acct)) {
+		return TRUE;
+	}
+
+	if (g_hash_table_size(m->tags)) {
+		for (l = s->tags; l; l = g_slist_next(l)) {
+			char *tag = g_utf8_casefold(l->data, -1);
+			gboolean muted = g_hash_table_contains(m->tags, tag);
+			g_free(tag);
+			if (muted) {
+				return TRUE;
+			}
+		}
+	}
+
+	for (i = 0; i < m->regexes->len; i++) {
+		GRegex *regex = g_ptr_array_index(m->regexes, i);
+		if ((s->content && g_regex_match(regex, s->content, 0, NULL)) ||
+		    (s->spoiler_text && g_regex_match(regex, s->spoiler_text, 0, NULL))) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+void mastodon_mute_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->mutes) {
+		g_hash_table_destroy(md->mutes);
+		md->mutes = NULL;
+	}
+}
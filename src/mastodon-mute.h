@@ -0,0 +1,68 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+
+/**
+ * Local mute rules. They never leave the plugin and apply per channel: the mute setting of a channel applies to it,
+ * and the mute setting of the account applies to the main channel and to statuses shown as private messages. The
+ * rules are separated by spaces:
+ *
+ *   /regex/          content or content warning matches, ignoring case
+ *   @user@domain     the author, or the author of a boosted status; * and ? are wildcards; @user is a local account
+ *   #tag             the status has this hashtag
+ *   domain           the author is on this instance, or a subdomain of it
+ *
+ * A rule that starts with a slash must end with one; a space in a regular expression is written as \s.
+ *
+ * A channel's rules are compiled the first time a status goes there, and again only when the setting changed: every
+ * regular expression is compiled once and optimized, and accounts, hashtags and domains without wildcards go into hash
+ * tables, so that the cost per status hardly depends on the number of these.
+ */
+
+/* What the rules look at, so that this doesn't need to know about struct mastodon_status. */
+struct mastodon_mute_status {
+	const char *acct;
+	const char *boosted_acct; /* NULL unless this is a boost */
+	const char *content;
+	const char *spoiler_text;
+	GSList *tags; /* of char *, without the # */
+};
+
+struct mastodon_mute {
+	set_t **sets; /* where the mute setting is: the channel's, or the account's */
+	char *rules; /* the setting this was compiled from */
+	GPtrArray *regexes; /* of GRegex */
+	GHashTable *accts; /* lower case user@domain */
+	GPtrArray *globs; /* of GPatternSpec, for accounts with wildcards */
+	GHashTable *tags; /* case folded */
+	GHashTable *domains; /* lower case */
+};
+
+char *mastodon_mute_eval(set_t *set, char *value);
+void mastodon_mute_chat(struct im_connection *ic, struct groupchat *c, set_t **sets);
+void mastodon_mute_chat_closed(struct im_connection *ic, struct groupchat *c);
+gboolean mastodon_mute_matches(struct im_connection *ic, struct groupchat *c, const struct mastodon_mute_status *s);
+void mastodon_mute_close(struct im_connection *ic);
@@ -0,0 +1,229 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-lib.h"
+#include "mastodon-parse.h"
+#include "mastodon-stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* An event to parse. It belongs to both the worker and the queue of its stream, hence the reference count: a stream
+ * may close while its events are still being parsed. */
+struct mastodon_parse_job {
+	gint ref;
+	gint done; /* set by the worker once parsed is valid */
+	mastodon_evt_flags_t type;
+	mastodon_timeline_type_t subscription;
+	GString *data;
+	json_value *parsed; /* NULL if the data could not be parsed */
+};
+
+static GThreadPool *mastodon_parse_pool = NULL;
+static int mastodon_parse_wakeup[2] = { -1, -1 }; /* the workers write a byte for every event done */
+
+static void mastodon_parse_job_unref(struct mastodon_parse_job *job)
+{
+	if (g_atomic_int_dec_and_test(&job->ref)) {
+		if (job->parsed) {
+			json_value_free(job->parsed);
+		}
+		g_string_free(job->data, TRUE);
+		g_free(job);
+	}
+}
+
+static void mastodon_parse_queue_free(GQueue *queue)
+{
+	g_queue_free_full(queue, (GDestroyNotify) mastodon_parse_job_unref);
+}
+
+/**
+ * Runs on a worker: nothing here may touch a connection.
+ */
+static void mastodon_parse_work(gpointer data, gpointer user_data)
+{
+	struct mastodon_parse_job *job = data;
+
+	job->parsed = json_parse(job->data->str, job->data->len);
+	g_atomic_int_set(&job->done, 1);
+
+	/* If the pipe is full, the main loop is going to look at the queues anyway. */
+	if (write(mastodon_parse_wakeup[1], "", 1) < 0 && errno != EAGAIN) {
+		g_warning("Cannot wake up the main loop: %s", g_strerror(errno));
+	}
+	mastodon_parse_job_unref(job);
+}
+
+/**
+ * Handle the events at the head of the queue of every stream, as long as they are done.
+ */
+static gboolean mastodon_parse_done(gpointer data, gint fd, b_input_condition cond)
+{
+	char buf[256];
+	GSList *connections, *l;
+
+	while (read(fd, buf, sizeof(buf)) > 0) {
+		/* Drain. */
+	}
+
+	/* Handling an event may close a stream or even log out, so look everything up again after each one. */
+	connections = g_slist_copy(mastodon_connections);
+	for (l = connections; l; l = g_slist_next(l)) {
+		struct im_connection *ic = l->data;
+		struct mastodon_data *md;
+		GList *streams, *s;
+
+		if (!g_slist_find(mastodon_connections, ic) || !(md = ic->proto_data)->parse_queues) {
+			continue;
+		}
+
+		streams = g_hash_table_get_keys(md->parse_queues);
+		for (s = streams; s; s = g_list_next(s)) {
+			struct http_request *req = s->data;
+			struct mastodon_parse_job *job;
+			GQueue *queue;
+
+			while (g_slist_find(mastodon_connections, ic) &&
+			       (queue = g_hash_table_lookup(md->parse_queues, req)) &&
+			       (job = g_queue_peek_head(queue)) &&
+			       g_atomic_int_get(&job->done)) {
+				g_queue_pop_head(queue);
+				if (job->parsed) {
+					mastodon_stream_handle_event(ic, job->type, job->parsed, job->subscription);
+				} else {
+					mastodon_stats_stream_failed(ic, req);
+				}
+				mastodon_parse_job_unref(job);
+			}
+
+			if (!g_slist_find(mastodon_connections, ic)) {
+				break;
+			}
+		}
+		g_list_free(streams);
+	}
+	g_slist_free(connections);
+
+	return TRUE;
+}
+
+/**
+ * Start the pool, or grow it if this account wants more threads than there are.
+ */
+static gboolean mastodon_parse_pool_get(int threads)
+{
+	GError *error = NULL;
+
+	if (mastodon_parse_pool) {
+		if (threads > g_thread_pool_get_max_threads(mastodon_parse_pool)) {
+			g_thread_pool_set_max_threads(mastodon_parse_pool, threads, NULL);
+		}
+		return TRUE;
+	}
+
+	if (pipe(mastodon_parse_wakeup) < 0) {
+		return FALSE;
+	}
+	fcntl(mastodon_parse_wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(mastodon_parse_wakeup[1], F_SETFL, O_NONBLOCK);
+
+	if (!(mastodon_parse_pool = g_thread_pool_new(mastodon_parse_work, NULL, threads, FALSE, &error))) {
+		g_warning("Cannot start threads for parsing: %s", error->message);
+		g_error_free(error);
+		close(mastodon_parse_wakeup[0]);
+		close(mastodon_parse_wakeup[1]);
+		return FALSE;
+	}
+
+	b_input_add(mastodon_parse_wakeup[0], B_EV_IO_READ, mastodon_parse_done, NULL);
+	return TRUE;
+}
+
+/**
+ * Hand the data of a stream event to the workers. This takes over data. Returns FALSE if the account doesn't use
+ * workers, in which case the caller still owns data and must parse it.
+ */
+gboolean mastodon_parse_submit(struct im_connection *ic, struct http_request *req, mastodon_evt_flags_t type,
+                               mastodon_timeline_type_t subscription, GString *data)
+{
+	struct mastodon_data *md = ic->proto_data;
+	int threads = set_getint(&ic->acc->set, "parse_threads");
+	GQueue *queue;
+
+	if (threads <= 0 || !mastodon_parse_pool_get(threads)) {
+		return FALSE;
+	}
+
+	if (!md->parse_queues) {
+		md->parse_queues = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+		                                         (GDestroyNotify) mastodon_parse_queue_free);
+	}
+	if (!(queue = g_hash_table_lookup(md->parse_queues, req))) {
+		queue = g_queue_new();
+		g_hash_table_insert(md->parse_queues, req, queue);
+	}
+
+	struct mastodon_parse_job *job = g_new0(struct mastodon_parse_job, 1);
+	job->ref = 2; /* the queue and the worker */
+	job->type = type;
+	job->subscription = subscription;
+	job->data = data;
+	g_queue_push_tail(queue, job);
+	g_thread_pool_push(mastodon_parse_pool, job, NULL);
+	return TRUE;
+}
+
+/**
+ * Test whether events of the stream are still waiting for the workers. Whatever arrives next must wait, too.
+ */
+gboolean mastodon_parse_pending(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+	GQueue *queue;
+
+	return md->parse_queues && (queue = g_hash_table_lookup(md->parse_queues, req)) && !g_queue_is_empty(queue);
+}
+
+/**
+ * Forget the events of a stream that have not been handled yet.
+ */
+void mastodon_parse_stream_closed(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->parse_queues) {
+		g_hash_table_remove(md->parse_queues, req);
+	}
+}
+
+void mastodon_parse_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->parse_queues) {
+		g_hash_table_destroy(md->parse_queues);
+		md->parse_queues = NULL;
+	}
+}
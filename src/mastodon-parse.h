@@ -0,0 +1,42 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+#include "http_client.h"
+#include "mastodon-lib.h"
+
+/**
+ * Parsing stream events on worker threads. With the parse_threads setting above zero, mastodon_http_stream() hands
+ * the data of each event to a thread pool shared by all connections instead of parsing it on the main loop. A worker
+ * marks the event done and writes to a pipe; the main loop then handles the events of every stream in the order they
+ * arrived, stopping at the first one still being parsed. Only json_parse() runs on the workers: turning the JSON into
+ * statuses uses the account cache, the filters and Bitlbee, all of which belong to the main loop.
+ */
+
+gboolean mastodon_parse_submit(struct im_connection *ic, struct http_request *req, mastodon_evt_flags_t type,
+                               mastodon_timeline_type_t subscription, GString *data);
+gboolean mastodon_parse_pending(struct im_connection *ic, struct http_request *req);
+void mastodon_parse_stream_closed(struct im_connection *ic, struct http_request *req);
+void mastodon_parse_close(struct im_connection *ic);
@@ -0,0 +1,272 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-record.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+struct mastodon_record {
+	FILE *file;
+	guint64 last_id;
+	GHashTable *streams; /* struct http_request * → struct mastodon_recorded * */
+};
+
+/* A request being recorded. Until the response arrives, it is also the callback data of the request. */
+struct mastodon_recorded {
+	struct im_connection *ic;
+	http_input_function func;
+	gpointer data;
+	guint64 id;
+	gboolean headers; /* the response headers have been recorded */
+	gsize seen; /* bytes of the stream body that have been recorded and not yet flushed */
+};
+
+static void mastodon_record_write(struct mastodon_record *rec, char type, guint64 id, int status, const char *data,
+                                  gsize len)
+{
+	gint64 now = g_get_real_time();
+
+	if (type == '<') {
+		fprintf(rec->file, "%c %" G_GINT64_FORMAT " %" G_GUINT64_FORMAT " %d %" G_GSIZE_FORMAT "\n",
+		        type, now, id, status, len);
+	} else {
+		fprintf(rec->file, "%c %" G_GINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GSIZE_FORMAT "\n",
+		        type, now, id, len);
+	}
+	if (len) {
+		fwrite(data, 1, len, rec->file);
+	}
+	fputc('\n', rec->file);
+	/* Keep the trace usable if Bitlbee crashes. */
+	fflush(rec->file);
+}
+
+/**
+ * Replace the values of the JSON string members that hold secrets with "***": the client secret the instance sends
+ * back when the app is registered and the tokens of an OAuth reply.
+ */
+static void mastodon_record_scrub(GString *body)
+{
+	static const char *const keys[] = { "\"client_secret\"", "\"access_token\"", "\"refresh_token\"" };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(keys); i++) {
+		gsize pos = 0;
+		char *key;
+
+		while ((key = strstr(body->str + pos, keys[i]))) {
+			gsize start = key - body->str + strlen(keys[i]);
+			gsize end;
+
+			start += strspn(body->str + start, " \t\r\n");
+			if (body->str[start] != ':') {
+				pos = start;
+				continue;
+			}
+			start++;
+			start += strspn(body->str + start, " \t\r\n");
+			if (body->str[start] != '"') {
+				pos = start;
+				continue;
+			}
+			start++;
+			for (end = start; end < body->len && body->str[end] != '"'; end++) {
+				if (body->str[end] == '\\' && end + 1 < body->len) {
+					end++;
+				}
+			}
+			g_string_erase(body, start, end - start);
+			g_string_insert(body, start, "***");
+			pos = start + 3;
+		}
+	}
+}
+
+static void mastodon_record_headers(struct mastodon_record *rec, struct mastodon_recorded *r, struct http_request *req)
+{
+	const char *headers = req->reply_headers ? req->reply_headers : "";
+	mastodon_record_write(rec, '<', r->id, req->status_code, headers, strlen(headers));
+	r->headers = TRUE;
+}
+
+/**
+ * Start recording if the record setting names a file. The file is appended to. See mastodon_file_path() for where it
+ * goes.
+ */
+void mastodon_record_open(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	const char *name = set_getstr(&ic->acc->set, "record");
+	char *path;
+	FILE *file;
+
+	if (!name || !*name) {
+		return;
+	}
+
+	if (!(path = mastodon_file_path(ic, name)) || !(file = fopen(path, "ab"))) {
+		imcb_error(ic, "Cannot record to %s: %s", name, g_strerror(errno));
+		g_free(path);
+		return;
+	}
+	g_free(path);
+
+	md->record = g_new0(struct mastodon_record, 1);
+	md->record->file = file;
+	md->record->streams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	imcb_log(ic, "Recording to %s", name);
+}
+
+void mastodon_record_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (!md->record) {
+		return;
+	}
+
+	fclose(md->record->file);
+	g_hash_table_destroy(md->record->streams);
+	g_free(md->record);
+	md->record = NULL;
+}
+
+/**
+ * Callback for recorded requests: record the response and hand it to the original callback.
+ */
+static void mastodon_record_response(struct http_request *req)
+{
+	struct mastodon_recorded *r = req->data;
+	struct im_connection *ic = r->ic;
+
+	req->func = r->func;
+	req->data = r->data;
+
+	if (g_slist_find(mastodon_connections, ic)) {
+		struct mastodon_data *md = ic->proto_data;
+		if (md->record) {
+			GString *body = g_string_new_len(req->reply_body, req->reply_body ? req->body_size : 0);
+			mastodon_record_scrub(body);
+			mastodon_record_headers(md->record, r, req);
+			mastodon_record_write(md->record, '=', r->id, 0, body->str, body->len);
+			mastodon_record_write(md->record, '.', r->id, 0, NULL, 0);
+			g_string_free(body, TRUE);
+		}
+	}
+
+	g_free(r);
+	req->func(req);
+}
+
+/**
+ * Record a request that was just made and arrange for its response to be recorded.
+ */
+void mastodon_record_request(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+	static const char auth[] = "\r\nAuthorization: Bearer ";
+
+	if (!md->record || !req) {
+		return;
+	}
+
+	struct mastodon_recorded *r = g_new0(struct mastodon_recorded, 1);
+	r->ic = ic;
+	r->func = req->func;
+	r->data = req->data;
+	r->id = ++md->record->last_id;
+
+	GString *request = g_string_new(req->request);
+	char *token = strstr(request->str, auth);
+	if (token) {
+		gsize start = token - request->str + strlen(auth);
+		g_string_erase(request, start, strcspn(request->str + start, "\r\n"));
+		g_string_insert(request, start, "***");
+	}
+	mastodon_record_write(md->record, '>', r->id, 0, request->str, request->len);
+	g_string_free(request, TRUE);
+
+	req->func = mastodon_record_response;
+	req->data = r;
+}
+
+/**
+ * A recorded request turned out to be a stream. From now on, mastodon_http_stream() records what arrives, since it
+ * knows how much of the body is new.
+ */
+void mastodon_record_streaming(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_recorded *r;
+
+	if (!md->record || req->func != mastodon_record_response) {
+		return;
+	}
+
+	r = req->data;
+	req->func = r->func;
+	req->data = r->data;
+	g_hash_table_insert(md->record->streams, req, r);
+}
+
+/**
+ * Record what a stream received since the last call, exactly as it came from the socket, or that it was closed.
+ */
+void mastodon_record_stream(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_recorded *r;
+
+	if (!md->record || !(r = g_hash_table_lookup(md->record->streams, req))) {
+		return;
+	}
+
+	if (!r->headers) {
+		mastodon_record_headers(md->record, r, req);
+	}
+
+	if (req->reply_body && req->body_size > r->seen) {
+		mastodon_record_write(md->record, '=', r->id, 0, req->reply_body + r->seen, req->body_size - r->seen);
+		r->seen = req->body_size;
+	}
+
+	if ((req->flags & HTTPC_EOF) || !req->reply_body) {
+		mastodon_record_write(md->record, '.', r->id, 0, NULL, 0);
+		g_hash_table_remove(md->record->streams, req);
+	}
+}
+
+/**
+ * Keep track of what the stream has already consumed: call this along with http_flush_bytes().
+ */
+void mastodon_record_flush(struct im_connection *ic, struct http_request *req, gsize len)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_recorded *r;
+
+	if (md->record && (r = g_hash_table_lookup(md->record->streams, req))) {
+		r->seen -= MIN(len, r->seen);
+	}
+}
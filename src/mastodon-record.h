@@ -0,0 +1,57 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+#include "http_client.h"
+
+/**
+ * Record mode: with the record setting naming a file, every request made through mastodon_http() and everything the
+ * server sends back is appended to it, so that real traffic can be replayed later. Each record is a header line
+ * followed by exactly as many bytes of data as the header says and a newline:
+ *
+ * > TIME ID LENGTH     the request, with the access token replaced by "***"
+ * < TIME ID STATUS LENGTH  the response headers
+ * = TIME ID LENGTH     body data; for streams, one record per read from the socket
+ * . TIME ID 0          the response is complete or the stream was closed
+ *
+ * The fields of a header line are separated by single spaces and written in decimal. TIME is the wall clock in
+ * microseconds when the data arrived, and ID numbers the requests of a connection, starting with 1. STATUS is the
+ * status code Bitlbee reports for the response. LENGTH counts the bytes of data and does not include the newline after
+ * them. The data is written as it was sent or received, apart from the secrets, and may itself contain newlines, so a
+ * reader has to read the header line, then LENGTH bytes, then skip one newline; it can't split the file into lines.
+ *
+ * The request record holds the request line, the headers and the body, as Bitlbee sent them. A request that is not a
+ * stream has exactly one = record with its whole body, and the values of "client_secret", "access_token" and
+ * "refresh_token" in it are replaced by "***". The records of concurrent requests are interleaved, so a reader has to
+ * collect them by ID; every request that completes ends with a . record.
+ */
+struct mastodon_record;
+
+void mastodon_record_open(struct im_connection *ic);
+void mastodon_record_close(struct im_connection *ic);
+void mastodon_record_request(struct im_connection *ic, struct http_request *req);
+void mastodon_record_streaming(struct im_connection *ic, struct http_request *req);
+void mastodon_record_stream(struct im_connection *ic, struct http_request *req);
+void mastodon_record_flush(struct im_connection *ic, struct http_request *req, gsize len);
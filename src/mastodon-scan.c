@@ -0,0 +1,175 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon-scan.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define MASTODON_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+struct mastodon_scanner {
+	const char *name;
+	const char *(*any2)(const char *p, const char *end, char a, char b);
+};
+
+/* Plain C version. This also finishes the tail of the vector version. */
+
+static const char *mastodon_scan_any2_generic(const char *p, const char *end, char a, char b)
+{
+	for (; p < end; p++) {
+		if (*p == a || *p == b) {
+			return p;
+		}
+	}
+	return end;
+}
+
+static const struct mastodon_scanner mastodon_scanner_generic = {
+	"generic",
+	mastodon_scan_any2_generic,
+};
+
+#ifdef MASTODON_SCAN_X86
+
+/* SSE2 is part of x86-64, so this doesn't need a runtime check there. */
+
+__attribute__((target("sse2")))
+static const char *mastodon_scan_any2_sse2(const char *p, const char *end, char a, char b)
+{
+	const __m128i va = _mm_set1_epi8(a);
+	const __m128i vb = _mm_set1_epi8(b);
+
+	if (end - p < 16) {
+		return mastodon_scan_any2_generic(p, end, a, b);
+	}
+
+	for (; p + 16 <= end; p += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *) p);
+		unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)));
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+
+	/* The last block overlaps bytes we already looked at; shift them out. */
+	if (p < end) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (end - 16));
+		unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)));
+		mask >>= 16 - (end - p);
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+	return end;
+}
+
+/* The default on x86. The text between tags is short, so a wider vector would rarely be filled. */
+static const struct mastodon_scanner mastodon_scanner_sse2 = {
+	"sse2",
+	mastodon_scan_any2_sse2,
+};
+
+#endif
+
+static const struct mastodon_scanner *mastodon_scanner = NULL;
+
+/**
+ * Pick the scanner implementation, so that benchmarks can compare them. MASTODON_SCAN_AUTO picks the default for the
+ * platform. Returns FALSE if the implementation requested is not available, in which case nothing changes. There is no
+ * need to call this: the first scan picks the default.
+ */
+gboolean mastodon_scan_select(mastodon_scan_impl_t impl)
+{
+	const struct mastodon_scanner *scanner = NULL;
+
+	switch (impl) {
+	case MASTODON_SCAN_AUTO:
+#ifdef MASTODON_SCAN_X86
+		scanner = &mastodon_scanner_sse2;
+#else
+		scanner = &mastodon_scanner_generic;
+#endif
+		break;
+	case MASTODON_SCAN_GENERIC:
+		scanner = &mastodon_scanner_generic;
+		break;
+	case MASTODON_SCAN_SSE2:
+#ifdef MASTODON_SCAN_X86
+		scanner = &mastodon_scanner_sse2;
+#endif
+		break;
+	}
+
+	if (scanner) {
+		mastodon_scanner = scanner;
+	}
+	return scanner != NULL;
+}
+
+/**
+ * The name of the scanner implementation in use, for benchmarks and debug output.
+ */
+const char *mastodon_scan_name(void)
+{
+	if (G_UNLIKELY(!mastodon_scanner)) {
+		mastodon_scan_select(MASTODON_SCAN_AUTO);
+	}
+	return mastodon_scanner->name;
+}
+
+/**
+ * Find the first c. The C library's memchr() is already vectorized everywhere we care about.
+ */
+const char *mastodon_scan_byte(const char *p, const char *end, char c)
+{
+	const char *q = p < end ? memchr(p, c, end - p) : NULL;
+	return q ? q : end;
+}
+
+/**
+ * Find the first occurrence of c twice in a row, such as the empty line ending a server-sent event. Newlines are rare
+ * in a stream, so memchr() skips from one to the next.
+ */
+const char *mastodon_scan_pair(const char *p, const char *end, char c)
+{
+	while (p + 1 < end && (p = memchr(p, c, end - p - 1))) {
+		if (p[1] == c) {
+			return p;
+		}
+		p++;
+	}
+	return end;
+}
+
+/**
+ * Find the first a or b, such as the next tag or entity in HTML.
+ */
+const char *mastodon_scan_any2(const char *p, const char *end, char a, char b)
+{
+	if (G_UNLIKELY(!mastodon_scanner)) {
+		mastodon_scan_select(MASTODON_SCAN_AUTO);
+	}
+	return mastodon_scanner->any2(p, end, a, b);
+}
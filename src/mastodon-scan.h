@@ -0,0 +1,42 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include <glib.h>
+
+/* Byte scanners for the loops that look at every byte we receive. All of them search the range [p, end) and return
+ * end if nothing was found. The single byte and pair scans use memchr(); the scan for either of two bytes has an SSE2
+ * version for x86, which every x86-64 CPU has, and uses plain C everywhere else. */
+
+typedef enum {
+	MASTODON_SCAN_AUTO,
+	MASTODON_SCAN_GENERIC,
+	MASTODON_SCAN_SSE2,
+} mastodon_scan_impl_t;
+
+gboolean mastodon_scan_select(mastodon_scan_impl_t impl);
+const char *mastodon_scan_name(void);
+const char *mastodon_scan_byte(const char *p, const char *end, char c);
+const char *mastodon_scan_pair(const char *p, const char *end, char c);
+const char *mastodon_scan_any2(const char *p, const char *end, char a, char b);
@@ -0,0 +1,543 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-cache.h"
+#include "mastodon-lag.h"
+#include "mastodon-stats.h"
+#include "mastodon-trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Names of the delivery latency histograms, by mastodon_stats_delivery_t. */
+const char *mastodon_stats_deliveries[MS_DELIVERIES] = {
+	"home", "local", "federated", "hashtag", "list", "notifications",
+};
+
+static int mastodon_histogram_bucket(guint64 value)
+{
+	if (value < MASTODON_HISTOGRAM_SUB) {
+		return value;
+	}
+	int k = 63 - __builtin_clzll(value);
+	return (k - 2) * MASTODON_HISTOGRAM_SUB + ((value >> (k - 3)) & (MASTODON_HISTOGRAM_SUB - 1));
+}
+
+/**
+ * The largest value that ends up in the bucket.
+ */
+guint64 mastodon_histogram_upper(int bucket)
+{
+	if (bucket < MASTODON_HISTOGRAM_SUB) {
+		return bucket;
+	}
+	int k = bucket / MASTODON_HISTOGRAM_SUB + 2;
+	guint64 lower = (guint64) (MASTODON_HISTOGRAM_SUB + bucket % MASTODON_HISTOGRAM_SUB) << (k - 3);
+	return lower + ((guint64) 1 << (k - 3)) - 1;
+}
+
+void mastodon_histogram_add(struct mastodon_histogram *h, guint64 value)
+{
+	h->buckets[mastodon_histogram_bucket(value)]++;
+	h->count++;
+	h->sum += value;
+	h->max = MAX(h->max, value);
+}
+
+/**
+ * Return the value below which the fraction q of all the values lie, such as 0.99 for the 99th percentile. This is the
+ * upper end of a bucket, but never more than the largest value seen.
+ */
+guint64 mastodon_histogram_percentile(const struct mastodon_histogram *h, double q)
+{
+	guint64 rank = (guint64) (q * h->count + 0.5);
+	guint64 seen = 0;
+	int i;
+
+	for (i = 0; i < MASTODON_HISTOGRAM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= MAX(rank, 1)) {
+			return MIN(mastodon_histogram_upper(i), h->max);
+		}
+	}
+	return h->max;
+}
+
+static void mastodon_stream_stats_free(struct mastodon_stream_stats *s)
+{
+	g_free(s->path);
+	g_free(s);
+}
+
+static void mastodon_endpoint_stats_free(struct mastodon_endpoint_stats *e)
+{
+	g_free(e->path);
+	g_free(e);
+}
+
+void mastodon_stats_open(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	/* Streams are not reconnected one by one: when one is closed, the account logs out and Bitlbee logs it in again,
+	 * with new connection data. So the count lives in a hidden setting of the account, and goes away with it. */
+	int logins = set_getint(&ic->acc->set, "logins");
+
+	set_setint(&ic->acc->set, "logins", logins + 1);
+
+	md->stats = g_new0(struct mastodon_stats, 1);
+	md->stats->started = g_get_monotonic_time();
+	md->stats->reconnects = logins;
+	md->stats->streams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+	                                           (GDestroyNotify) mastodon_stream_stats_free);
+	md->stats->endpoints = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                             (GDestroyNotify) mastodon_endpoint_stats_free);
+}
+
+void mastodon_stats_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (!md->stats) {
+		return;
+	}
+
+	g_hash_table_destroy(md->stats->streams);
+	g_hash_table_destroy(md->stats->endpoints);
+	g_free(md->stats);
+	md->stats = NULL;
+}
+
+/**
+ * Get the path of the request from its request line. Without the query, ids are replaced by ":id" so that all the
+ * requests for the same endpoint are counted together.
+ */
+static char *mastodon_stats_path(struct http_request *req, gboolean query)
+{
+	const char *start = req->request ? strchr(req->request, ' ') : NULL;
+	GString *path = g_string_new("");
+
+	if (!start) {
+		return g_string_free(path, FALSE);
+	}
+
+	start++;
+	gsize len = strcspn(start, query ? " \r\n" : "? \r\n");
+	if (query) {
+		g_string_append_len(path, start, len);
+		return g_string_free(path, FALSE);
+	}
+
+	const char *end = start + len;
+	while (start < end) {
+		const char *slash = memchr(start + 1, '/', end - start - 1);
+		const char *next = slash ? slash : end;
+		const char *p;
+		for (p = start + 1; p < next && g_ascii_isdigit(*p); p++);
+		if (p == next && next > start + 1) {
+			g_string_append(path, "/:id");
+		} else {
+			g_string_append_len(path, start, next - start);
+		}
+		start = next;
+	}
+	return g_string_free(path, FALSE);
+}
+
+/* A request waiting for its reply. Until it arrives, this is also the callback data of the request. */
+struct mastodon_stats_pending {
+	struct im_connection *ic;
+	http_input_function func;
+	gpointer data;
+	gint64 start;
+};
+
+/**
+ * Callback for all requests: count the reply and hand it to the original callback.
+ */
+static void mastodon_stats_response(struct http_request *req)
+{
+	struct mastodon_stats_pending *r = req->data;
+	struct im_connection *ic = r->ic;
+
+	req->func = r->func;
+	req->data = r->data;
+
+	if (g_slist_find(mastodon_connections, ic)) {
+		struct mastodon_data *md = ic->proto_data;
+		if (md->stats) {
+			char *path = mastodon_stats_path(req, FALSE);
+			struct mastodon_endpoint_stats *e = g_hash_table_lookup(md->stats->endpoints, path);
+			if (e) {
+				g_free(path);
+			} else {
+				e = g_new0(struct mastodon_endpoint_stats, 1);
+				e->path = path;
+				g_hash_table_insert(md->stats->endpoints, e->path, e);
+			}
+			e->status[CLAMP(req->status_code / 100, 0, 5)]++;
+			mastodon_histogram_add(&e->latency, g_get_monotonic_time() - r->start);
+			md->stats->in_flight--;
+			mastodon_trace_event(ic, MTR_REQUEST, MTR_END, GPOINTER_TO_SIZE(r), req->status_code, 0, e->path);
+		}
+	}
+
+	g_free(r);
+	req->func(req);
+}
+
+/**
+ * Count a request that was just made and arrange for its reply to be counted.
+ */
+void mastodon_stats_request(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (!md->stats || !req) {
+		return;
+	}
+
+	struct mastodon_stats_pending *r = g_new0(struct mastodon_stats_pending, 1);
+	r->ic = ic;
+	r->func = req->func;
+	r->data = req->data;
+	r->start = g_get_monotonic_time();
+	md->stats->in_flight++;
+	mastodon_trace_event(ic, MTR_REQUEST, MTR_BEGIN, GPOINTER_TO_SIZE(r), 0, 0, NULL);
+
+	req->func = mastodon_stats_response;
+	req->data = r;
+}
+
+/**
+ * A request turned out to be a stream. It no longer counts as a request; from now on its events are counted.
+ */
+void mastodon_stats_streaming(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_stats_pending *r;
+
+	if (!md->stats || req->func != mastodon_stats_response) {
+		return;
+	}
+
+	r = req->data;
+	req->func = r->func;
+	req->data = r->data;
+	md->stats->in_flight--;
+	mastodon_trace_event(ic, MTR_REQUEST, MTR_END, GPOINTER_TO_SIZE(r), req->status_code, 0, NULL);
+
+	struct mastodon_stream_stats *s = g_new0(struct mastodon_stream_stats, 1);
+	s->path = mastodon_stats_path(req, TRUE);
+	s->opened = r->start;
+	g_hash_table_insert(md->stats->streams, req, s);
+	g_free(r);
+}
+
+/**
+ * Count an event the stream handled, len bytes long. It failed if the data could not be parsed.
+ */
+void mastodon_stats_stream_event(struct im_connection *ic, struct http_request *req, mastodon_evt_flags_t type,
+                                 gsize len, gboolean failed)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_stream_stats *s;
+
+	if (!md->stats || !(s = g_hash_table_lookup(md->stats->streams, req))) {
+		return;
+	}
+
+	s->events[type]++;
+	s->bytes += len;
+	if (failed) {
+		s->parse_failures++;
+	}
+	if (type != MASTODON_EVT_UNKNOWN) {
+		s->last_event = g_get_monotonic_time();
+	}
+}
+
+/**
+ * Count an event whose data could not be parsed after it was counted, see mastodon-parse.h.
+ */
+void mastodon_stats_stream_failed(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_stream_stats *s;
+
+	if (md->stats && (s = g_hash_table_lookup(md->stats->streams, req))) {
+		s->parse_failures++;
+	}
+}
+
+void mastodon_stats_stream_closed(struct im_connection *ic, struct http_request *req)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->stats) {
+		g_hash_table_remove(md->stats->streams, req);
+	}
+}
+
+/**
+ * Add the time since start, from mastodon_trace_clock(), to what, and record it in the trace.
+ */
+void mastodon_stats_time(struct im_connection *ic, mastodon_stats_time_t what, gint64 start)
+{
+	struct mastodon_data *md = ic->proto_data;
+	gint64 end = mastodon_trace_clock();
+
+	if (md->stats) {
+		md->stats->time[what] += end - start;
+		md->stats->calls[what]++;
+	}
+	mastodon_trace_span(ic, MTR_PARSE + what, start, end);
+}
+
+void mastodon_stats_count(struct im_connection *ic, mastodon_stats_counter_t what)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->stats) {
+		md->stats->counters[what]++;
+	}
+}
+
+/**
+ * Count a status or notification that was just shown, created at created_at_ms, in milliseconds since the epoch.
+ * Clocks differ, so it may seem to come from the future; that counts as no delay at all.
+ */
+void mastodon_stats_delivered(struct im_connection *ic, mastodon_stats_delivery_t where, gint64 created_at_ms)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->stats) {
+		gint64 ms = g_get_real_time() / 1000 - created_at_ms;
+		mastodon_histogram_add(&md->stats->delivery[where], MAX(ms, 0));
+	}
+}
+
+/**
+ * Format a duration in microseconds for people.
+ */
+static char *mastodon_stats_duration(char *buf, gsize size, gint64 us)
+{
+	if (us < 1000) {
+		g_snprintf(buf, size, "%" G_GINT64_FORMAT " µs", us);
+	} else if (us < 1000000) {
+		g_snprintf(buf, size, "%.1f ms", us / 1e3);
+	} else if (us < 600 * G_USEC_PER_SEC) {
+		g_snprintf(buf, size, "%.1f s", us / 1e6);
+	} else if (us < (gint64) 48 * 3600 * G_USEC_PER_SEC) {
+		g_snprintf(buf, size, "%" G_GINT64_FORMAT " h %02" G_GINT64_FORMAT " min",
+		           us / 3600 / G_USEC_PER_SEC, us / 60 / G_USEC_PER_SEC % 60);
+	} else {
+		g_snprintf(buf, size, "%" G_GINT64_FORMAT " days", us / 86400 / G_USEC_PER_SEC);
+	}
+	return buf;
+}
+
+static gint mastodon_stats_compare_endpoints(gconstpointer a, gconstpointer b)
+{
+	const struct mastodon_endpoint_stats *x = a;
+	const struct mastodon_endpoint_stats *y = b;
+	return strcmp(x->path, y->path);
+}
+
+/**
+ * The stats command: report everything we counted.
+ */
+void mastodon_stats_show(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_stats *st = md->stats;
+	gint64 now = g_get_monotonic_time();
+	char a[32], b[32], c[32], d[32];
+	GSList *l;
+	int i;
+
+	if (!st) {
+		mastodon_log(ic, "No statistics available.");
+		return;
+	}
+
+	mastodon_log(ic, "Connected for %s, %u reconnects, %u requests in flight",
+	             mastodon_stats_duration(a, sizeof(a), now - st->started), st->reconnects, st->in_flight);
+
+	for (l = md->streams; l; l = g_slist_next(l)) {
+		struct mastodon_stream_stats *s = g_hash_table_lookup(st->streams, l->data);
+		if (!s) {
+			continue;
+		}
+		char *bytes = g_format_size(s->bytes);
+		mastodon_log(ic, "Stream %s: open for %s, %" G_GUINT64_FORMAT " updates, %" G_GUINT64_FORMAT
+		             " notifications, %" G_GUINT64_FORMAT " deletes, %" G_GUINT64_FORMAT " other, %s, %"
+		             G_GUINT64_FORMAT " parse failures, last event %s%s",
+		             s->path, mastodon_stats_duration(a, sizeof(a), now - s->opened),
+		             s->events[MASTODON_EVT_UPDATE], s->events[MASTODON_EVT_NOTIFICATION],
+		             s->events[MASTODON_EVT_DELETE], s->events[MASTODON_EVT_UNKNOWN], bytes, s->parse_failures,
+		             s->last_event ? mastodon_stats_duration(b, sizeof(b), now - s->last_event) : "never",
+		             s->last_event ? " ago" : "");
+		g_free(bytes);
+	}
+
+	static const char *classes[] = { "failed", "1xx", "2xx", "3xx", "4xx", "5xx" };
+	GList *endpoints = g_list_sort(g_hash_table_get_values(st->endpoints), mastodon_stats_compare_endpoints);
+	GList *e;
+	for (e = endpoints; e; e = g_list_next(e)) {
+		struct mastodon_endpoint_stats *es = e->data;
+		GString *status = g_string_new("");
+		for (i = 0; i < 6; i++) {
+			if (es->status[i]) {
+				g_string_append_printf(status, "%s%" G_GUINT64_FORMAT " %s", status->len ? ", " : "",
+				                       es->status[i], classes[i]);
+			}
+		}
+		mastodon_log(ic, "Requests %s: %" G_GUINT64_FORMAT " (%s), p50 %s, p90 %s, p99 %s, max %s",
+		             es->path, es->latency.count, status->str,
+		             mastodon_stats_duration(a, sizeof(a), mastodon_histogram_percentile(&es->latency, 0.5)),
+		             mastodon_stats_duration(b, sizeof(b), mastodon_histogram_percentile(&es->latency, 0.9)),
+		             mastodon_stats_duration(c, sizeof(c), mastodon_histogram_percentile(&es->latency, 0.99)),
+		             mastodon_stats_duration(d, sizeof(d), es->latency.max));
+		g_string_free(status, TRUE);
+	}
+	g_list_free(endpoints);
+
+	int used = 0;
+	if (md->log) {
+		for (i = 0; i < MASTODON_LOG_LENGTH; i++) {
+			if (md->log[i].id) {
+				used++;
+			}
+		}
+	}
+	mastodon_log(ic, "Filter hits %" G_GUINT64_FORMAT ", dedup hits %" G_GUINT64_FORMAT ", mute hits %"
+	             G_GUINT64_FORMAT ", log %d/%d, account cache %u (%" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT
+	             " misses)",
+	             st->counters[MS_FILTER_HITS], st->counters[MS_DEDUP_HITS], st->counters[MS_MUTE_HITS], used,
+	             MASTODON_LOG_LENGTH,
+	             g_hash_table_size(md->accounts), st->counters[MS_ACCOUNT_CACHE_HITS],
+	             st->counters[MS_ACCOUNT_CACHE_MISSES]);
+	mastodon_log(ic, "Status cache %u (%" G_GUINT64_FORMAT " updates not parsed again)",
+	             mastodon_status_cache_size(ic), st->counters[MS_STATUS_CACHE_HITS]);
+
+	mastodon_log(ic, "Time spent: parse %s (%" G_GUINT64_FORMAT "), filter %s (%" G_GUINT64_FORMAT
+	             "), render %s (%" G_GUINT64_FORMAT ")",
+	             mastodon_stats_duration(a, sizeof(a), st->time[MS_PARSE] / 1000), st->calls[MS_PARSE],
+	             mastodon_stats_duration(b, sizeof(b), st->time[MS_FILTER] / 1000), st->calls[MS_FILTER],
+	             mastodon_stats_duration(c, sizeof(c), st->time[MS_RENDER] / 1000), st->calls[MS_RENDER]);
+
+	if (md->lag) {
+		mastodon_log(ic, "Main loop lag %s, longest stream callback %s, %" G_GUINT64_FORMAT " statuses skipped%s",
+		             mastodon_stats_duration(a, sizeof(a), md->lag->lag / 1000),
+		             mastodon_stats_duration(b, sizeof(b), md->lag->max_hold / 1000), md->lag->skipped_total,
+		             md->lag->every ? " (lagging now)" : "");
+	}
+}
+
+/**
+ * The stats delivery command: percentiles of the delivery latency for every kind of stream that delivered anything.
+ */
+void mastodon_stats_show_delivery(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	char a[32], b[32], c[32], d[32], e[32];
+	gboolean any = FALSE;
+	int i;
+
+	if (!md->stats) {
+		mastodon_log(ic, "No statistics available.");
+		return;
+	}
+
+	for (i = 0; i < MS_DELIVERIES; i++) {
+		struct mastodon_histogram *h = &md->stats->delivery[i];
+		if (!h->count) {
+			continue;
+		}
+		any = TRUE;
+		mastodon_log(ic, "Delivery %s: %" G_GUINT64_FORMAT ", p50 %s, p90 %s, p99 %s, p99.9 %s, max %s",
+		             mastodon_stats_deliveries[i], h->count,
+		             mastodon_stats_duration(a, sizeof(a), mastodon_histogram_percentile(h, 0.5) * 1000),
+		             mastodon_stats_duration(b, sizeof(b), mastodon_histogram_percentile(h, 0.9) * 1000),
+		             mastodon_stats_duration(c, sizeof(c), mastodon_histogram_percentile(h, 0.99) * 1000),
+		             mastodon_stats_duration(d, sizeof(d), mastodon_histogram_percentile(h, 0.999) * 1000),
+		             mastodon_stats_duration(e, sizeof(e), h->max * 1000));
+	}
+
+	if (!any) {
+		mastodon_log(ic, "Nothing was delivered by a stream, yet.");
+	}
+}
+
+/**
+ * The stats save command: write the delivery latency histograms to a file, in the percentile distribution format of
+ * HdrHistogram, so that the usual tools can plot them. Values are in milliseconds. See mastodon_file_path() for where
+ * the file goes.
+ */
+void mastodon_stats_save_delivery(struct im_connection *ic, const char *name)
+{
+	struct mastodon_data *md = ic->proto_data;
+	char *path;
+	FILE *file;
+	int i, j;
+
+	if (!md->stats) {
+		mastodon_log(ic, "No statistics available.");
+		return;
+	}
+
+	if (!(path = mastodon_file_path(ic, name)) || !(file = fopen(path, "w"))) {
+		mastodon_log(ic, "Cannot save to %s: %s", name, g_strerror(errno));
+		g_free(path);
+		return;
+	}
+	g_free(path);
+
+	for (i = 0; i < MS_DELIVERIES; i++) {
+		struct mastodon_histogram *h = &md->stats->delivery[i];
+		guint64 seen = 0;
+
+		fprintf(file, "# %s\n%12s %14s %10s %14s\n\n", mastodon_stats_deliveries[i],
+		        "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+		for (j = 0; j < MASTODON_HISTOGRAM_BUCKETS && seen < h->count; j++) {
+			if (!h->buckets[j]) {
+				continue;
+			}
+			seen += h->buckets[j];
+			double q = (double) seen / h->count;
+			fprintf(file, "%12.3f %2.12f %10" G_GUINT64_FORMAT, (double) MIN(mastodon_histogram_upper(j), h->max),
+			        q, seen);
+			if (q < 1) {
+				fprintf(file, " %14.2f", 1 / (1 - q));
+			}
+			fputc('\n', file);
+		}
+		fprintf(file, "#[Mean    = %12.3f, Max            = %12.3f]\n", h->count ? (double) h->sum / h->count : 0.0,
+		        (double) h->max);
+		fprintf(file, "#[Total count    = %12" G_GUINT64_FORMAT "]\n\n", h->count);
+	}
+
+	fclose(file);
+	mastodon_log(ic, "Delivery latency saved to %s", name);
+}
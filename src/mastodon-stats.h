@@ -0,0 +1,123 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+#include "http_client.h"
+#include "mastodon-lib.h"
+
+/**
+ * Runtime statistics for the stats command: what the streams deliver, how long requests take, and where the time goes
+ * while handling events. Counting is cheap enough to be always on.
+ */
+
+/* Buckets of a histogram: values below 8 are exact; above that, every power of two is split into 8 buckets, so that a
+ * value is off by less than 12.5% at most. This covers all of guint64. */
+#define MASTODON_HISTOGRAM_SUB 8
+#define MASTODON_HISTOGRAM_BUCKETS (62 * MASTODON_HISTOGRAM_SUB)
+
+struct mastodon_histogram {
+	guint64 count;
+	guint64 sum;
+	guint64 max;
+	guint32 buckets[MASTODON_HISTOGRAM_BUCKETS];
+};
+
+void mastodon_histogram_add(struct mastodon_histogram *h, guint64 value);
+guint64 mastodon_histogram_upper(int bucket);
+guint64 mastodon_histogram_percentile(const struct mastodon_histogram *h, double q);
+
+/* Where time goes while handling events and replies, see mastodon_stats_time. The order matches mastodon_trace_type_t. */
+typedef enum {
+	MS_PARSE, /* the JSON parser */
+	MS_FILTER, /* checking statuses against filters */
+	MS_RENDER, /* turning statuses into text and handing it to Bitlbee */
+	MS_TIMES,
+} mastodon_stats_time_t;
+
+typedef enum {
+	MS_FILTER_HITS, /* statuses hidden by a filter */
+	MS_DEDUP_HITS, /* statuses not shown because they had just been shown */
+	MS_MUTE_HITS, /* statuses not shown because of the mute rules of every channel they were going to */
+	MS_STATUS_CACHE_HITS, /* updates not parsed because the status had just arrived on another stream */
+	MS_ACCOUNT_CACHE_HITS, /* accounts found in md->accounts */
+	MS_ACCOUNT_CACHE_MISSES, /* accounts added to md->accounts */
+	MS_COUNTERS,
+} mastodon_stats_counter_t;
+
+/* Delivery latency, from when a status was posted or a notification happened until it was shown on IRC, is kept per
+ * kind of stream. Only what arrives by a stream counts. */
+typedef enum {
+	MS_HOME,
+	MS_LOCAL,
+	MS_FEDERATED,
+	MS_HASHTAG,
+	MS_LIST,
+	MS_NOTIFICATIONS,
+	MS_DELIVERIES,
+} mastodon_stats_delivery_t;
+
+struct mastodon_stream_stats {
+	char *path; /* with the query, since that names the hashtag or list */
+	gint64 opened; /* monotonic time in microseconds */
+	gint64 last_event; /* ditto, 0 if there was none */
+	guint64 events[MASTODON_EVT_DELETE + 1]; /* by type; MASTODON_EVT_UNKNOWN counts heartbeats and ignored events */
+	guint64 bytes;
+	guint64 parse_failures;
+};
+
+struct mastodon_endpoint_stats {
+	char *path; /* without the query, and ids replaced by ":id" */
+	guint64 status[6]; /* replies by the first digit of the status code; 0 means there was no reply */
+	struct mastodon_histogram latency; /* microseconds */
+};
+
+struct mastodon_stats {
+	gint64 started; /* monotonic time in microseconds */
+	guint reconnects;
+	guint in_flight; /* requests waiting for a reply, not counting streams */
+	GHashTable *streams; /* struct http_request * → struct mastodon_stream_stats * */
+	GHashTable *endpoints; /* path → struct mastodon_endpoint_stats * */
+	guint64 counters[MS_COUNTERS];
+	gint64 time[MS_TIMES]; /* nanoseconds */
+	guint64 calls[MS_TIMES];
+	struct mastodon_histogram delivery[MS_DELIVERIES]; /* milliseconds */
+};
+
+extern const char *mastodon_stats_deliveries[MS_DELIVERIES];
+
+void mastodon_stats_open(struct im_connection *ic);
+void mastodon_stats_close(struct im_connection *ic);
+void mastodon_stats_request(struct im_connection *ic, struct http_request *req);
+void mastodon_stats_streaming(struct im_connection *ic, struct http_request *req);
+void mastodon_stats_stream_event(struct im_connection *ic, struct http_request *req, mastodon_evt_flags_t type,
+                                 gsize len, gboolean failed);
+void mastodon_stats_stream_failed(struct im_connection *ic, struct http_request *req);
+void mastodon_stats_stream_closed(struct im_connection *ic, struct http_request *req);
+void mastodon_stats_time(struct im_connection *ic, mastodon_stats_time_t what, gint64 start);
+void mastodon_stats_count(struct im_connection *ic, mastodon_stats_counter_t what);
+void mastodon_stats_delivered(struct im_connection *ic, mastodon_stats_delivery_t where, gint64 created_at_ms);
+void mastodon_stats_show(struct im_connection *ic);
+void mastodon_stats_show_delivery(struct im_connection *ic);
+void mastodon_stats_save_delivery(struct im_connection *ic, const char *name);
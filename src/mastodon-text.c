@@ -0,0 +1,343 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon-text.h"
+#include "mastodon-scan.h"
+#include <string.h>
+
+struct mastodon_entity {
+	const char *name;
+	const char *text; /* UTF-8, never longer than "&name;" */
+};
+
+/* Mastodon itself only escapes the first five; the others show up in content from other software. */
+static const struct mastodon_entity mastodon_entities[] = {
+	{ "amp", "&" },
+	{ "lt", "<" },
+	{ "gt", ">" },
+	{ "quot", "\"" },
+	{ "apos", "'" },
+	{ "nbsp", "\xc2\xa0" },
+	{ "hellip", "\xe2\x80\xa6" },
+	{ "mdash", "\xe2\x80\x94" },
+	{ "ndash", "\xe2\x80\x93" },
+	{ "laquo", "\xc2\xab" },
+	{ "raquo", "\xc2\xbb" },
+	{ "copy", "\xc2\xa9" },
+	{ "reg", "\xc2\xae" },
+	{ NULL, NULL },
+};
+
+/**
+ * Decode the entity at in (pointing at the ampersand) into out. Returns the number of bytes consumed, or 0 if this is
+ * not an entity we know, in which case nothing was written. The number of bytes written is returned via written and is
+ * never larger than the number of bytes consumed.
+ */
+static gsize mastodon_html_entity(char *out, const char *in, gsize *written)
+{
+	const char *p = in + 1;
+
+	if (*p == '#') {
+		gunichar c = 0;
+		gboolean hex = (p[1] == 'x' || p[1] == 'X');
+		const char *digits = p = hex ? p + 2 : p + 1;
+
+		for (; hex ? g_ascii_isxdigit(*p) : g_ascii_isdigit(*p); p++) {
+			c = c * (hex ? 16 : 10) + g_ascii_xdigit_value(*p);
+			if (c > 0x10FFFF) {
+				return 0;
+			}
+		}
+
+		/* A code point needs at least as many digits as it has UTF-8 bytes, so this never grows. */
+		if (p == digits || *p != ';' || c == 0 || !g_unichar_validate(c)) {
+			return 0;
+		}
+
+		*written = g_unichar_to_utf8(c, out);
+		return p + 1 - in;
+	}
+
+	while (g_ascii_isalnum(*p)) {
+		p++;
+	}
+
+	gsize len = p - in - 1;
+	int i;
+	for (i = 0; mastodon_entities[i].name; i++) {
+		const struct mastodon_entity *e = &mastodon_entities[i];
+		if (strncmp(e->name, in + 1, len) == 0 && e->name[len] == '\0') {
+			/* Like Bitlbee, accept a missing semicolon. */
+			gsize consumed = len + 1 + (*p == ';');
+			*written = strlen(e->text);
+			memcpy(out, e->text, *written);
+			return consumed;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Find the end of the tag starting at in (pointing at the less-than sign). Quoted attribute values may contain a
+ * greater-than sign. Returns NULL if the tag isn't closed.
+ */
+static const char *mastodon_html_tag_end(const char *in)
+{
+	char quote = 0;
+
+	for (in++; *in; in++) {
+		if (quote) {
+			if (*in == quote) {
+				quote = 0;
+			}
+		} else if (*in == '"' || *in == '\'') {
+			quote = *in;
+		} else if (*in == '>') {
+			return in;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Convert the HTML Mastodon uses for status content to text for IRC in a single pass, writing to out, which must
+ * have room for strlen(in) + 1 bytes. The output is never longer than the input, so out may be the same as in for
+ * conversion in place. Returns the length of the output.
+ *
+ * Tags are dropped, except that <br> becomes a newline, paragraphs are separated by a newline, and <b> and <i> become
+ * the IRC codes for bold and underline, as Bitlbee's strip_html() does. Named and numeric entities are decoded; unknown
+ * ones are left alone. Mastodon shortens links by wrapping parts of the URL in spans with the classes "invisible" and
+ * "ellipsis" and leaves it to CSS to hide them; we keep their text so that the full URL ends up on IRC.
+ */
+gsize mastodon_html_to_text(char *out, const char *in)
+{
+	char *s = out;
+	const char *stop = in + strlen(in);
+	gboolean paragraph = FALSE; /* a paragraph ended and the next output needs to start on a new line */
+
+	while (*in) {
+		if (*in != '<' && *in != '&') {
+			/* Copy plain text up to the next tag or entity in one go. */
+			const char *next = mastodon_scan_any2(in, stop, '<', '&');
+			if (paragraph) {
+				*(s++) = '\n';
+				paragraph = FALSE;
+			}
+			if (s != in) {
+				memmove(s, in, next - in);
+			}
+			s += next - in;
+			in = next;
+			continue;
+		}
+
+		if (*in == '<' && (g_ascii_isalpha(in[1]) || in[1] == '/')) {
+			const char *end = mastodon_html_tag_end(in);
+			if (end) {
+				const char *name = in + 1;
+				gboolean closing = (*name == '/');
+				if (closing) {
+					name++;
+				}
+				gsize len = 0;
+				while (g_ascii_isalnum(name[len])) {
+					len++;
+				}
+				in = end + 1;
+
+				if (len == 1 && g_ascii_tolower(*name) == 'p') {
+					if (closing && s != out) {
+						paragraph = TRUE;
+					}
+					continue;
+				}
+
+				char c = 0;
+				if (len == 2 && g_ascii_strncasecmp(name, "br", 2) == 0) {
+					c = '\n';
+				} else if (len == 1 && g_ascii_tolower(*name) == 'b') {
+					c = '\x02';
+				} else if (len == 1 && g_ascii_tolower(*name) == 'i') {
+					c = '\x1f';
+				}
+
+				if (c) {
+					if (paragraph) {
+						*(s++) = '\n';
+						paragraph = FALSE;
+					}
+					*(s++) = c;
+				}
+				continue;
+			}
+		}
+
+		if (paragraph) {
+			*(s++) = '\n';
+			paragraph = FALSE;
+		}
+
+		if (*in == '&') {
+			gsize written = 0;
+			gsize consumed = mastodon_html_entity(s, in, &written);
+			if (consumed) {
+				s += written;
+				in += consumed;
+				continue;
+			}
+		}
+
+		*(s++) = *(in++);
+	}
+
+	*s = '\0';
+	return s - out;
+}
+
+/**
+ * Test whether the text is pure ASCII.
+ */
+gboolean mastodon_text_is_ascii(const char *s)
+{
+	for (; *s; s++) {
+		if (*s & 0x80) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Find needle in the ASCII text haystack, ignoring case. The needle must already be case folded, as with
+ * g_utf8_casefold(). For ASCII text, that gives the same result as folding the haystack and using strstr() but needs
+ * no copy. A needle with non-ASCII characters is never found.
+ */
+const char *mastodon_text_ascii_strcasestr(const char *haystack, const char *needle)
+{
+	if (!*needle) {
+		return haystack;
+	}
+
+	for (; *haystack; haystack++) {
+		if (g_ascii_tolower(*haystack) != *needle) {
+			continue;
+		}
+		gsize i = 1;
+		while (needle[i] && g_ascii_tolower(haystack[i]) == needle[i]) {
+			i++;
+		}
+		if (!needle[i]) {
+			return haystack;
+		}
+	}
+	return NULL;
+}
+
+/* Mastodon counts every URL as this many characters, no matter how long it is. */
+#define MASTODON_TEXT_URL_LENGTH 23
+
+/**
+ * Return the length of the URL at s, or 0 if there is none. A URL starts with http:// or https:// and goes on until
+ * the next whitespace.
+ */
+static gsize mastodon_text_url(const char *s)
+{
+	const char *p;
+
+	if (strncmp(s, "http", 4) != 0) {
+		return 0;
+	}
+	p = s + 4;
+	if (*p == 's') {
+		p++;
+	}
+	if (strncmp(p, "://", 3) != 0) {
+		return 0;
+	}
+	p += 3;
+	if (!*p || g_ascii_isspace(*p)) {
+		return 0;
+	}
+	while (*p && !g_ascii_isspace(*p)) {
+		p++;
+	}
+	return p - s;
+}
+
+/**
+ * Return the length of the remote mention at s, such as @kensanata@octodon.social, or 0 if there is none. The length
+ * of the username part is returned via user.
+ */
+static gsize mastodon_text_mention(const char *s, gsize *user)
+{
+	const char *p = s + 1;
+	const char *end = NULL;
+
+	if (*s != '@') {
+		return 0;
+	}
+	while (g_ascii_isalnum(*p) || *p == '_') {
+		p++;
+	}
+	if (p == s + 1 || *p != '@') {
+		return 0;
+	}
+	*user = p - s - 1;
+	/* The domain must end in a letter or digit. */
+	for (p++; g_ascii_isalnum(*p) || *p == '.' || *p == '-'; p++) {
+		if (g_ascii_isalnum(*p)) {
+			end = p + 1;
+		}
+	}
+	if (!end || (gsize) (end - s) < *user + 4) {
+		return 0;
+	}
+	return end - s;
+}
+
+/**
+ * Count the characters of a post the way Mastodon does: every URL counts as 23 characters and remote mentions only
+ * count with their username, so @kensanata@octodon.social counts as @kensanata. This is a single pass over the text
+ * and doesn't allocate anything.
+ */
+glong mastodon_text_post_length(const char *text)
+{
+	const char *s = text;
+	glong len = 0;
+	gsize n, user;
+
+	while (*s) {
+		if (*s == 'h' && (n = mastodon_text_url(s))) {
+			len += MASTODON_TEXT_URL_LENGTH;
+			s += n;
+		} else if (*s == '@' && (n = mastodon_text_mention(s, &user))) {
+			len += 1 + user;
+			s += n;
+		} else {
+			len++;
+			s = g_utf8_next_char(s);
+		}
+	}
+	return len;
+}
@@ -0,0 +1,236 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-lib.h"
+#include "mastodon-trace.h"
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+static const char *mastodon_trace_names[MTR_TYPES] = {
+	"request", "stream event", "parse", "filter", "render", "decision",
+};
+
+static const char *mastodon_trace_decisions[] = {
+	"shown", "filtered", "duplicate", "muted",
+};
+
+/* By mastodon_evt_flags_t. */
+static const char *mastodon_trace_stream_events[] = {
+	"other", "update", "notification", "delete",
+};
+
+/**
+ * Monotonic time in nanoseconds. Spans are measured with this, and so are the times of mastodon_stats_time(). This
+ * lives here rather than in the header because mastodon-lib.c asks for an older POSIX that lacks clock_gettime().
+ */
+gint64 mastodon_trace_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void mastodon_trace_open(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	md->trace = g_new0(struct mastodon_trace, 1);
+}
+
+void mastodon_trace_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	g_free(md->trace);
+	md->trace = NULL;
+}
+
+static inline struct mastodon_trace_event *mastodon_trace_next(struct mastodon_trace *t)
+{
+	return &t->events[t->next++ & (MASTODON_TRACE_LENGTH - 1)];
+}
+
+/**
+ * Record an event that happens now. The id connects the two halves of a span across callbacks, such as a request and
+ * its reply; for other events it can tell the reader where the event came from.
+ */
+void mastodon_trace_event(struct im_connection *ic, mastodon_trace_type_t type, mastodon_trace_phase_t phase,
+                          guint64 id, guint32 arg, guint8 detail, const char *name)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->trace) {
+		*mastodon_trace_next(md->trace) = (struct mastodon_trace_event) {
+			.ns = mastodon_trace_clock(),
+			.id = id,
+			.name = name,
+			.arg = arg,
+			.type = type,
+			.phase = phase,
+			.detail = detail,
+		};
+	}
+}
+
+/**
+ * Record a span from start to end, both from mastodon_trace_clock().
+ */
+void mastodon_trace_span(struct im_connection *ic, mastodon_trace_type_t type, gint64 start, gint64 end)
+{
+	struct mastodon_data *md = ic->proto_data;
+
+	if (md->trace) {
+		*mastodon_trace_next(md->trace) = (struct mastodon_trace_event) {
+			.ns = start,
+			.duration = MIN(end - start, G_MAXUINT32),
+			.type = type,
+			.phase = MTR_SPAN,
+		};
+	}
+}
+
+/**
+ * The trace command: say how much the ring holds.
+ */
+void mastodon_trace_show(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_trace *t = md->trace;
+
+	if (!t || !t->next) {
+		mastodon_log(ic, "The trace is empty.");
+		return;
+	}
+
+	guint64 first = t->next > MASTODON_TRACE_LENGTH ? t->next - MASTODON_TRACE_LENGTH : 0;
+	gint64 ns = mastodon_trace_clock() - t->events[first & (MASTODON_TRACE_LENGTH - 1)].ns;
+	mastodon_log(ic, "The trace holds %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " events recorded, "
+	             "covering the last %.1f s.", t->next - first, t->next, ns / 1e9);
+}
+
+static void mastodon_trace_string(FILE *file, const char *s)
+{
+	fputc('"', file);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', file);
+			fputc(*s, file);
+		} else if ((guchar) *s < 0x20) {
+			fprintf(file, "\\u%04x", *s);
+		} else {
+			fputc(*s, file);
+		}
+	}
+	fputc('"', file);
+}
+
+/**
+ * Write one event in the Chrome trace event format. Times are in microseconds since origin.
+ */
+static void mastodon_trace_write(FILE *file, const struct mastodon_trace_event *e, gint64 origin)
+{
+	fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"mastodon\",\"pid\":1,\"tid\":1,\"ts\":%.3f",
+	        mastodon_trace_names[e->type], (e->ns - origin) / 1e3);
+
+	switch (e->phase) {
+	case MTR_INSTANT:
+		fprintf(file, ",\"ph\":\"i\",\"s\":\"t\"");
+		break;
+	case MTR_SPAN:
+		fprintf(file, ",\"ph\":\"X\",\"dur\":%.3f", e->duration / 1e3);
+		break;
+	case MTR_BEGIN:
+	case MTR_END:
+		fprintf(file, ",\"ph\":\"%s\",\"id\":\"0x%" G_GINT64_MODIFIER "x\"", e->phase == MTR_BEGIN ? "b" : "e", e->id);
+		break;
+	}
+
+	switch (e->type) {
+	case MTR_REQUEST:
+		if (e->phase == MTR_END) {
+			fprintf(file, ",\"args\":{\"status\":%u", e->arg);
+			if (e->name) {
+				fprintf(file, ",\"endpoint\":");
+				mastodon_trace_string(file, e->name);
+			}
+			fputc('}', file);
+		}
+		break;
+	case MTR_STREAM_EVENT:
+		fprintf(file, ",\"args\":{\"stream\":\"0x%" G_GINT64_MODIFIER "x\",\"type\":\"%s\",\"bytes\":%u}", e->id,
+		        mastodon_trace_stream_events[MIN(e->detail, G_N_ELEMENTS(mastodon_trace_stream_events) - 1)], e->arg);
+		break;
+	case MTR_DECISION:
+		fprintf(file, ",\"args\":{\"id\":\"%" G_GUINT64_FORMAT "\",\"decision\":\"%s\"}", e->id,
+		        mastodon_trace_decisions[MIN(e->arg, G_N_ELEMENTS(mastodon_trace_decisions) - 1)]);
+		break;
+	}
+
+	fputc('}', file);
+}
+
+/**
+ * The trace dump command: write the ring to a file for chrome://tracing or Perfetto, oldest event first. See
+ * mastodon_file_path() for where the file goes.
+ */
+void mastodon_trace_dump(struct im_connection *ic, const char *name)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_trace *t = md->trace;
+	char *path;
+	FILE *file;
+	guint64 i, first;
+
+	if (!t || !t->next) {
+		mastodon_log(ic, "The trace is empty.");
+		return;
+	}
+
+	if (!(path = mastodon_file_path(ic, name)) || !(file = fopen(path, "w"))) {
+		mastodon_log(ic, "Cannot save to %s: %s", name, g_strerror(errno));
+		g_free(path);
+		return;
+	}
+	g_free(path);
+
+	first = t->next > MASTODON_TRACE_LENGTH ? t->next - MASTODON_TRACE_LENGTH : 0;
+	gint64 origin = t->events[first & (MASTODON_TRACE_LENGTH - 1)].ns;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+	        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":");
+	mastodon_trace_string(file, ic->acc->user);
+	fputs("}}", file);
+	for (i = first; i < t->next; i++) {
+		mastodon_trace_write(file, &t->events[i & (MASTODON_TRACE_LENGTH - 1)], origin);
+	}
+	fputs("\n]}\n", file);
+
+	if (fclose(file) != 0) {
+		mastodon_log(ic, "Cannot save to %s: %s", name, g_strerror(errno));
+		return;
+	}
+	mastodon_log(ic, "%" G_GUINT64_FORMAT " trace events saved to %s", t->next - first, name);
+}
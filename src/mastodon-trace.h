@@ -0,0 +1,84 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+
+/**
+ * An always-on trace of what a connection does, kept in a ring of fixed-size binary records so that recording an
+ * event costs a clock read and a few stores: no formatting, no allocation. The trace dump command writes the ring in
+ * the Chrome trace event format, which chrome://tracing and https://ui.perfetto.dev can show.
+ */
+
+/* Number of events kept; a power of two. */
+#define MASTODON_TRACE_LENGTH 4096
+
+typedef enum {
+	MTR_REQUEST, /* from sending a request until its reply arrived; arg is the status code */
+	MTR_STREAM_EVENT, /* an event a stream handled; arg is its length in bytes */
+	MTR_PARSE, /* the JSON parser */
+	MTR_FILTER, /* checking a status against the filters */
+	MTR_RENDER, /* turning a status into text and handing it to Bitlbee */
+	MTR_DECISION, /* what happened to a status; arg is a mastodon_trace_decision_t */
+	MTR_TYPES,
+} mastodon_trace_type_t;
+
+typedef enum {
+	MTR_SHOWN,
+	MTR_FILTERED,
+	MTR_DUPLICATE,
+	MTR_MUTED,
+} mastodon_trace_decision_t;
+
+typedef enum {
+	MTR_INSTANT,
+	MTR_SPAN, /* start and duration */
+	MTR_BEGIN, /* for spans across callbacks, connected by their id */
+	MTR_END,
+} mastodon_trace_phase_t;
+
+struct mastodon_trace_event {
+	gint64 ns; /* see mastodon_trace_clock() */
+	guint64 id; /* connects MTR_BEGIN and MTR_END */
+	const char *name; /* optional detail; must outlive the ring, such as the endpoint paths of mastodon-stats.h */
+	guint32 duration; /* nanoseconds, for MTR_SPAN */
+	guint32 arg;
+	guint8 type;
+	guint8 phase;
+	guint8 detail; /* the event type of a stream event */
+};
+
+struct mastodon_trace {
+	guint64 next; /* total number of events recorded; the ring index is this modulo MASTODON_TRACE_LENGTH */
+	struct mastodon_trace_event events[MASTODON_TRACE_LENGTH];
+};
+
+gint64 mastodon_trace_clock(void);
+void mastodon_trace_open(struct im_connection *ic);
+void mastodon_trace_close(struct im_connection *ic);
+void mastodon_trace_event(struct im_connection *ic, mastodon_trace_type_t type, mastodon_trace_phase_t phase,
+                          guint64 id, guint32 arg, guint8 detail, const char *name);
+void mastodon_trace_span(struct im_connection *ic, mastodon_trace_type_t type, gint64 start, gint64 end);
+void mastodon_trace_show(struct im_connection *ic);
+void mastodon_trace_dump(struct im_connection *ic, const char *name);
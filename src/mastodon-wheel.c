@@ -0,0 +1,198 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#include "mastodon.h"
+#include "mastodon-wheel.h"
+
+static void mastodon_wheel_unlink(struct mastodon_wheel_timer *t)
+{
+	struct mastodon_wheel *wheel = t->wheel;
+
+	g_queue_delete_link(&wheel->slots[t->deadline % MASTODON_WHEEL_SLOTS], t->link);
+	wheel->count--;
+}
+
+/**
+ * Fire the timers in the slot for second that are due by now. A callback may add and cancel timers, even in this
+ * slot, so we start over after every one of them.
+ */
+static void mastodon_wheel_turn(struct mastodon_wheel *wheel, time_t second, time_t now)
+{
+	GQueue *slot = &wheel->slots[second % MASTODON_WHEEL_SLOTS];
+	GList *l = slot->head;
+
+	while (l) {
+		struct mastodon_wheel_timer *t = l->data;
+		if (t->deadline > now) {
+			l = l->next;
+			continue;
+		}
+		mastodon_wheel_unlink(t);
+		t->func(wheel->ic, t->data);
+		g_free(t);
+		l = slot->head;
+	}
+}
+
+static gboolean mastodon_wheel_tick(gpointer data, gint fd, b_input_condition cond);
+
+/**
+ * Arm the Bitlbee timeout for the earliest deadline, or at least check again after MASTODON_WHEEL_SLEEP seconds. The
+ * deadline is in seconds, so the timeout fires up to a second late but never early.
+ */
+static void mastodon_wheel_arm(struct mastodon_wheel *wheel, time_t deadline)
+{
+	time_t now = time(NULL);
+	time_t wait = CLAMP(deadline - now, 0, MASTODON_WHEEL_SLEEP);
+
+	if (wheel->timer) {
+		b_event_remove(wheel->timer);
+	}
+	wheel->due = now + wait;
+	wheel->timer = b_timeout_add(wait * 1000, mastodon_wheel_tick, wheel);
+}
+
+static gboolean mastodon_wheel_tick(gpointer data, gint fd, b_input_condition cond)
+{
+	struct mastodon_wheel *wheel = data;
+	time_t now = time(NULL);
+	time_t second, next = 0;
+	GList *l;
+	int i;
+
+	/* This timeout is done; a new one is armed below if anything is left. */
+	wheel->timer = 0;
+
+	/* Catch up on the seconds since the last tick, but look at every slot at most once. */
+	wheel->ticking = TRUE;
+	for (second = wheel->now + 1; second <= now && second <= wheel->now + MASTODON_WHEEL_SLOTS; second++) {
+		mastodon_wheel_turn(wheel, second, now);
+	}
+	wheel->now = now;
+	wheel->ticking = FALSE;
+
+	if (wheel->count) {
+		for (i = 0; i < MASTODON_WHEEL_SLOTS; i++) {
+			for (l = wheel->slots[i].head; l; l = l->next) {
+				struct mastodon_wheel_timer *t = l->data;
+				if (!next || t->deadline < next) {
+					next = t->deadline;
+				}
+			}
+		}
+		mastodon_wheel_arm(wheel, next);
+	}
+	return FALSE;
+}
+
+void mastodon_wheel_open(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	int i;
+
+	md->wheel = g_new0(struct mastodon_wheel, 1);
+	md->wheel->ic = ic;
+	md->wheel->now = time(NULL);
+	for (i = 0; i < MASTODON_WHEEL_SLOTS; i++) {
+		g_queue_init(&md->wheel->slots[i]);
+	}
+}
+
+/**
+ * Logging out: the timers still scheduled are freed without firing. Close this last, after the modules owning the
+ * timers are done with them.
+ */
+void mastodon_wheel_close(struct im_connection *ic)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_wheel *wheel = md->wheel;
+	int i;
+
+	if (!wheel) {
+		return;
+	}
+	if (wheel->timer) {
+		b_event_remove(wheel->timer);
+	}
+	for (i = 0; i < MASTODON_WHEEL_SLOTS; i++) {
+		g_list_free_full(wheel->slots[i].head, g_free);
+	}
+	g_free(wheel);
+	md->wheel = NULL;
+}
+
+/**
+ * Call func with data once the deadline has passed. A deadline in the past fires within a second. Returns the handle
+ * for mastodon_wheel_cancel().
+ */
+struct mastodon_wheel_timer *mastodon_wheel_add(struct im_connection *ic, time_t deadline, mastodon_wheel_func func,
+                                                gpointer data)
+{
+	struct mastodon_data *md = ic->proto_data;
+	struct mastodon_wheel *wheel = md->wheel;
+	struct mastodon_wheel_timer *t = g_new0(struct mastodon_wheel_timer, 1);
+
+	/* An idle wheel doesn't tick, so it doesn't know what time it is. */
+	if (!wheel->count && !wheel->ticking) {
+		wheel->now = time(NULL);
+	}
+
+	/* Anything overdue goes into the next second, a slot that no tick has handled, yet, so that it doesn't wait for a
+	 * whole turn. Don't use wheel->now for this: while the wheel is ticking, it is the second before the catch-up. */
+	t->wheel = wheel;
+	t->deadline = MAX(deadline, time(NULL) + 1);
+	t->func = func;
+	t->data = data;
+
+	GQueue *slot = &wheel->slots[t->deadline % MASTODON_WHEEL_SLOTS];
+	g_queue_push_tail(slot, t);
+	t->link = slot->tail;
+	wheel->count++;
+
+	/* While ticking, the tick arms the timeout when it is done. */
+	if (!wheel->ticking && (!wheel->timer || t->deadline < wheel->due)) {
+		mastodon_wheel_arm(wheel, t->deadline);
+	}
+	return t;
+}
+
+/**
+ * Cancel a timer that hasn't fired, yet. Does nothing for NULL.
+ */
+void mastodon_wheel_cancel(struct mastodon_wheel_timer *t)
+{
+	struct mastodon_wheel *wheel;
+
+	if (!t) {
+		return;
+	}
+	wheel = t->wheel;
+	mastodon_wheel_unlink(t);
+	g_free(t);
+
+	/* If there are other timers, the timeout may now fire for nothing; the tick then arms it for the earliest. */
+	if (!wheel->count && wheel->timer && !wheel->ticking) {
+		b_event_remove(wheel->timer);
+		wheel->timer = 0;
+	}
+}
@@ -0,0 +1,65 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Simple module to facilitate Mastodon functionality.                      *
+*                                                                           *
+*  Copyright 2017-2019 Alex Schroeder <alex@gnu.org>                        *
+*                                                                           *
+*  This library is free software; you can redistribute it and/or            *
+*  modify it under the terms of the GNU Lesser General Public               *
+*  License as published by the Free Software Foundation, version            *
+*  2.1.                                                                     *
+*                                                                           *
+*  This library is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU        *
+*  Lesser General Public License for more details.                          *
+*                                                                           *
+*  You should have received a copy of the GNU Lesser General Public License *
+*  along with this library; if not, write to the Free Software Foundation,  *
+*  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA           *
+*                                                                           *
+****************************************************************************/
+
+#pragma once
+
+#include "nogaim.h"
+
+/**
+ * A timer wheel for housekeeping that happens at a certain time: filters that expire, windows that close. Bitlbee
+ * would need an event source per deadline; the wheel needs one timeout per connection, armed for the earliest
+ * deadline, and only while something is scheduled. Deadlines are in seconds and hashed into MASTODON_WHEEL_SLOTS slots,
+ * so a tick only looks at the slots of the seconds since the last one. Timers further away than one turn of the wheel
+ * simply stay in their slot for another turn.
+ *
+ * A timer is freed when it fires or is cancelled. The owner must forget its handle in the callback.
+ */
+
+#define MASTODON_WHEEL_SLOTS 64
+#define MASTODON_WHEEL_SLEEP 3600 /* seconds; the longest timeout, since Bitlbee takes milliseconds in an int */
+
+typedef void (*mastodon_wheel_func)(struct im_connection *ic, gpointer data);
+
+struct mastodon_wheel_timer {
+	struct mastodon_wheel *wheel;
+	time_t deadline;
+	mastodon_wheel_func func;
+	gpointer data;
+	GList *link; /* in the slot */
+};
+
+struct mastodon_wheel {
+	struct im_connection *ic;
+	GQueue slots[MASTODON_WHEEL_SLOTS];
+	time_t now; /* the last second handled */
+	guint count;
+	gint timer;
+	time_t due; /* when the timer fires */
+	gboolean ticking; /* callbacks are running; the tick decides what happens to the timer */
+};
+
+void mastodon_wheel_open(struct im_connection *ic);
+void mastodon_wheel_close(struct im_connection *ic);
+struct mastodon_wheel_timer *mastodon_wheel_add(struct im_connection *ic, time_t deadline, mastodon_wheel_func func,
+                                                gpointer data);
+void mastodon_wheel_cancel(struct mastodon_wheel_timer *t);
@@ -31,10 +31,24 @@
 #include "mastodon.h"
 #include "mastodon-http.h"
 #include "mastodon-lib.h"
+#include "mastodon-metrics.h"
+#include "mastodon-burst.h"
+#include "mastodon-cache.h"
+#include "mastodon-lag.h"
+#include "mastodon-limit.h"
+#include "mastodon-mute.h"
+#include "mastodon-parse.h"
+#include "mastodon-record.h"
+#include "mastodon-stats.h"
+#include "mastodon-trace.h"
+#include "mastodon-text.h"
+#include "mastodon-wheel.h"
 #include "rot13.h"
 #include "url.h"
 #include "help.h"
+#include <errno.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 
 #define HELPFILE_NAME "mastodon-help.txt"
 
@@ -152,61 +166,38 @@ static struct oauth2_service *get_oauth2_service(struct im_connection *ic)
 }
 
 /**
- * Check message length by comparing it to the appropriate setting.
+ * Check message length by comparing it to the limit of the instance, or the appropriate setting if we don't know it.
  * Note this issue: "Count all URLs in text as 23 characters flat, do
  * not count domain part of usernames."
  * https://github.com/tootsuite/mastodon/pull/4427
  **/
 static gboolean mastodon_length_check(struct im_connection *ic, gchar *msg, char *cw)
 {
-	int len = g_utf8_strlen(msg, -1);
-	if (len == 0) {
+	struct mastodon_data *md = ic->proto_data;
+
+	if (!*msg) {
 		mastodon_log(ic, "This message is empty.");
 		return FALSE;
 	}
 
-	if (cw != NULL) {
-		len += g_utf8_strlen(cw, -1);
-	}
-
 	int max = set_getint(&ic->acc->set, "message_length");
 	if (max == 0) {
 		return TRUE;
 	}
-
-	GRegex *regex = g_regex_new (MASTODON_URL_REGEX, 0, 0, NULL);
-	GMatchInfo *match_info;
-
-	g_regex_match (regex, msg, 0, &match_info);
-	while (g_match_info_matches (match_info))
-	{
-	    gchar *url = g_match_info_fetch (match_info, 0);
-	    len = len - g_utf8_strlen(url, -1) + 23;
-	    g_free (url);
-	    g_match_info_next (match_info, NULL);
+	if (md->max_characters > 0) {
+		max = md->max_characters;
 	}
-	g_regex_unref (regex);
 
-	regex = g_regex_new (MASTODON_MENTION_REGEX, 0, 0, NULL);
-	g_regex_match (regex, msg, 0, &match_info);
-	while (g_match_info_matches (match_info))
-	{
-	    gchar *mention = g_match_info_fetch (match_info, 0);
-	    gchar *nick = g_match_info_fetch (match_info, 2);
-	    len = len - g_utf8_strlen(mention, -1) + g_utf8_strlen(nick, -1);
-	    g_free (mention);
-	    g_free (nick);
-	    g_match_info_next (match_info, NULL);
+	glong len = mastodon_text_post_length(msg);
+	if (cw != NULL) {
+		len += g_utf8_strlen(cw, -1);
 	}
-	g_regex_unref (regex);
-
-	g_match_info_free (match_info);
 
 	if (len <= max) {
 		return TRUE;
 	}
 
-	mastodon_log(ic, "Maximum message length exceeded: %d > %d", len, max);
+	mastodon_log(ic, "Maximum message length exceeded: %ld > %d", len, max);
 
 	return FALSE;
 }
@@ -251,6 +242,32 @@ static char *set_eval_visibility(set_t * set, char *value)
 	}
 }
 
+/**
+ * Users only ever name files, see mastodon_file_path(): no directories, and nothing hidden, which includes "..".
+ */
+static gboolean mastodon_file_name_ok(const char *name)
+{
+	return name && *name && *name != '.' && !strchr(name, '/');
+}
+
+static char *set_eval_file_name(set_t * set, char *value)
+{
+	if (!*value || mastodon_file_name_ok(value)) {
+		return value;
+	} else {
+		return SET_INVALID;
+	}
+}
+
+static char *set_eval_metrics(set_t * set, char *value)
+{
+	if (!*value || mastodon_file_name_ok(g_str_has_prefix(value, "unix:") ? value + 5 : value)) {
+		return value;
+	} else {
+		return SET_INVALID;
+	}
+}
+
 static void mastodon_init(account_t * acc)
 {
 	set_t *s;
@@ -348,6 +365,20 @@ no_instance_in_username:
 	s = set_add(&acc->set, "hide_favourites", "false", set_eval_bool, acc);
 	s = set_add(&acc->set, "hide_mentions", "false", set_eval_bool, acc);
 	s = set_add(&acc->set, "hide_follows", "false", set_eval_bool, acc);
+	s = set_add(&acc->set, "notification_burst", "30", set_eval_int, acc);
+
+	s = set_add(&acc->set, "mute", NULL, mastodon_mute_eval, acc);
+
+	s = set_add(&acc->set, "record", "", set_eval_file_name, acc);
+	s->flags |= ACC_SET_OFFLINE_ONLY;
+
+	s = set_add(&acc->set, "metrics", "", set_eval_metrics, acc);
+	s->flags |= ACC_SET_OFFLINE_ONLY;
+
+	s = set_add(&acc->set, "parse_threads", "0", set_eval_int, acc);
+	s->flags |= ACC_SET_OFFLINE_ONLY;
+
+	s = set_add(&acc->set, "lag_threshold", "250", set_eval_int, acc);
 
 	s = set_add(&acc->set, "app_id", "0", set_eval_int, acc);
 	s->flags |= SET_HIDDEN;
@@ -361,6 +392,9 @@ no_instance_in_username:
 	s = set_add(&acc->set, "consumer_secret", "", NULL, acc);
 	s->flags |= SET_HIDDEN;
 
+	s = set_add(&acc->set, "logins", "0", set_eval_int, acc);
+	s->flags |= SET_HIDDEN | SET_NOSAVE;
+
 	mastodon_help_init();
 }
 
@@ -423,6 +457,8 @@ static void mastodon_connect(struct im_connection *ic)
 		mastodon_verify_credentials(ic);
 	}
 
+	mastodon_get_instance(ic);
+
 	/* Create the room. */
 	if (md->flags & MASTODON_MODE_CHAT) {
 		mastodon_groupchat_init(ic);
@@ -471,6 +507,13 @@ static void mastodon_login(account_t * acc)
 	mastodon_connections = g_slist_append(mastodon_connections, ic);
 	ic->proto_data = md;
 	md->user = g_strdup(acc->user);
+	md->accounts = mastodon_account_cache_new();
+	mastodon_record_open(ic);
+	mastodon_stats_open(ic);
+	mastodon_trace_open(ic);
+	mastodon_lag_open(ic);
+	mastodon_wheel_open(ic);
+	mastodon_metrics_open(ic);
 
 	if (!url_set(&url, set_getstr(&ic->acc->set, "base_url"))) {
 		imcb_error(ic, "Cannot parse API base URL: %s", set_getstr(&ic->acc->set, "base_url"));
@@ -546,20 +589,34 @@ static void mastodon_logout(struct im_connection *ic)
 
 		g_slist_free(md->streams); md->streams = NULL;
 
+		mastodon_http_retry_cancel(ic);
+		mastodon_metrics_close(ic);
+		mastodon_record_close(ic);
+		mastodon_stats_close(ic);
+		mastodon_trace_close(ic);
+		mastodon_parse_close(ic);
+		mastodon_lag_close(ic);
+		mastodon_limit_close(ic);
+		mastodon_burst_close(ic);
+		mastodon_mute_close(ic);
+		mastodon_status_cache_close(ic);
+
 		if (md->log) {
 			/* When mastodon_connect hasn't been called, yet, such as when imc_logout is being called from
 			 * mastodon_login, the log hasn not yet been initialised. */
 			int i;
 			for (i = 0; i < MASTODON_LOG_LENGTH; i++) {
-				g_slist_free_full(md->log[i].mentions, g_free); md->log[i].mentions = NULL;
+				g_slist_free_full(md->log[i].mentions, (GDestroyNotify) mastodon_account_unref); md->log[i].mentions = NULL;
 				g_free(md->log[i].spoiler_text);
 			}
 			g_free(md->log); md->log = NULL;
 		}
 
 		mastodon_filters_destroy(md);
+		mastodon_wheel_close(ic);
 
-		g_slist_free_full(md->mentions, g_free); md->mentions = NULL;
+		g_slist_free_full(md->mentions, (GDestroyNotify) mastodon_account_unref); md->mentions = NULL;
+		mastodon_account_cache_free(md->accounts); md->accounts = NULL;
 		g_free(md->last_spoiler_text); md->last_spoiler_text = NULL;
 		g_free(md->spoiler_text); md->spoiler_text = NULL;
 
@@ -847,6 +904,21 @@ static void mastodon_chat_msg(struct groupchat *c, char *message, int flags)
 	}
 }
 
+/**
+ * The settings every channel gets.
+ */
+static void mastodon_chat_add_settings(account_t *acc, set_t **head)
+{
+	mastodon_limit_add_settings(acc, head);
+	set_add(head, "mute", NULL, mastodon_mute_eval, NULL);
+}
+
+static void mastodon_chat_free_settings(account_t *acc, set_t **head)
+{
+	mastodon_limit_free_settings(acc, head);
+	set_del(head, "mute");
+}
+
 /**
  * Joining a group chat means showing the appropriate timeline and start streaming it.
  */
@@ -886,6 +958,8 @@ static struct groupchat *mastodon_chat_join(struct im_connection *ic,
 	}
 	g_free(topic);
 	c->data = req;
+	mastodon_limit_stream(ic, req, sets);
+	mastodon_mute_chat(ic, c, sets);
 	return c;
 }
 
@@ -898,6 +972,8 @@ static void mastodon_chat_leave(struct groupchat *c)
 	GSList *l;
 	struct mastodon_data *md = c->ic->proto_data;
 
+	mastodon_mute_chat_closed(c->ic, c);
+
 	if (c == md->timeline_gc) {
 		md->timeline_gc = NULL;
 	} else {
@@ -906,6 +982,9 @@ static void mastodon_chat_leave(struct groupchat *c)
 			struct http_request *req = l->data;
 			if (stream == req) {
 				md->streams = g_slist_remove(md->streams, req);
+				mastodon_stats_stream_closed(c->ic, req);
+				mastodon_parse_stream_closed(c->ic, req);
+				mastodon_limit_stream_closed(c->ic, req);
 				http_close(req);
 				break;
 			}
@@ -932,7 +1011,7 @@ static void mastodon_buddy_data_free(bee_user_t *bu)
 {
 	struct mastodon_user_data *mud = (struct mastodon_user_data*) bu->data;
 	g_slist_free_full(mud->lists, g_free); mud->lists = NULL;
-	g_slist_free_full(mud->mentions, g_free); mud->mentions = NULL;
+	g_slist_free_full(mud->mentions, (GDestroyNotify) mastodon_account_unref); mud->mentions = NULL;
 	g_free(mud->spoiler_text); mud->spoiler_text = NULL;
 	g_free(bu->data);
 }
@@ -1411,6 +1490,29 @@ static void mastodon_handle_command(struct im_connection *ic, char *message, mas
 		} else {
 			mastodon_log(ic, "Usage: 'api [get|put|post|delete] url [name value]*");
 		}
+	} else if (g_ascii_strcasecmp(cmd[0], "stats") == 0) {
+		if (!cmd[1]) {
+			mastodon_stats_show(ic);
+		} else if (g_ascii_strcasecmp(cmd[1], "delivery") == 0) {
+			mastodon_stats_show_delivery(ic);
+		} else if (g_ascii_strcasecmp(cmd[1], "save") == 0 && cmd[2]) {
+			mastodon_stats_save_delivery(ic, cmd[2]);
+		} else {
+			mastodon_log(ic, "Usage:\n"
+				     "- stats\n"
+				     "- stats delivery\n"
+				     "- stats save <file>");
+		}
+	} else if (g_ascii_strcasecmp(cmd[0], "trace") == 0) {
+		if (!cmd[1]) {
+			mastodon_trace_show(ic);
+		} else if (g_ascii_strcasecmp(cmd[1], "dump") == 0 && cmd[2]) {
+			mastodon_trace_dump(ic, cmd[2]);
+		} else {
+			mastodon_log(ic, "Usage:\n"
+				     "- trace\n"
+				     "- trace dump <file>");
+		}
 	} else if (g_ascii_strcasecmp(cmd[0], "undo") == 0) {
 		if (cmd[1] == NULL) {
 			mastodon_undo(ic);
@@ -1763,6 +1865,44 @@ void mastodon_log(struct im_connection *ic, char *format, ...)
 	g_free(text);
 }
 
+/**
+ * Return the path of a file the user named, or NULL with errno set. Bitlbee writes these files with the rights of the
+ * daemon and may serve many users, so users only give a name, never a path. Every user who identified to Bitlbee gets
+ * a directory of their own below the directory "mastodon" in Bitlbee's ConfigDir. That directory is up to the admin: if
+ * it doesn't exist, nothing is written.
+ */
+char *mastodon_file_path(struct im_connection *ic, const char *name)
+{
+	irc_t *irc = ic->bee->ui_data;
+	char *base, *nick, *dir, *path = NULL;
+	struct stat st;
+
+	if (!mastodon_file_name_ok(name)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	base = g_build_filename(global.conf->configdir, "mastodon", NULL);
+	nick = g_ascii_strdown(irc->user->nick, -1);
+	dir = g_build_filename(base, nick, NULL);
+
+	if (!(irc->status & USTATUS_IDENTIFIED) || !mastodon_file_name_ok(nick) ||
+	    !g_file_test(base, G_FILE_TEST_IS_DIR)) {
+		errno = EACCES;
+	} else if (mkdir(dir, 0700) == 0 || errno == EEXIST) {
+		if (lstat(dir, &st) == 0 && S_ISDIR(st.st_mode)) {
+			path = g_build_filename(dir, name, NULL);
+		} else {
+			errno = ENOTDIR;
+		}
+	}
+
+	g_free(base);
+	g_free(nick);
+	g_free(dir);
+	return path;
+}
+
 G_MODULE_EXPORT void init_plugin(void)
 {
 	struct prpl *ret = g_new0(struct prpl, 1);
@@ -1779,6 +1919,8 @@ G_MODULE_EXPORT void init_plugin(void)
 	ret->chat_msg = mastodon_chat_msg;
 	ret->chat_join = mastodon_chat_join;
 	ret->chat_leave = mastodon_chat_leave;
+	ret->chat_add_settings = mastodon_chat_add_settings;
+	ret->chat_free_settings = mastodon_chat_free_settings;
 	ret->add_permit = mastodon_add_permit;
 	ret->rem_permit = mastodon_rem_permit;
 	ret->add_deny = mastodon_add_deny;
@@ -35,8 +35,6 @@
 
 #define MASTODON_OAUTH_HANDLE "mastodon_oauth"
 #define MASTODON_SCOPE "read+write+follow" // URL escaped
-#define MASTODON_URL_REGEX "https?://\\S+"
-#define MASTODON_MENTION_REGEX "@(([a-zA-Z0-9_]+)@[a-zA-Z0-9.-]+[a-zA-Z0-9])"
 
 typedef enum {
 	MASTODON_HAVE_FRIENDS      = 0x00001,
@@ -48,6 +46,7 @@ typedef enum {
 	MASTODON_GOT_FILTERS       = 0x00040,
 	MASTODON_GOT_STATUS        = 0x00100,
 	MASTODON_GOT_CONTEXT       = 0x00200,
+	MASTODON_FILTERS_V1        = 0x00400, /* the instance has no Filters v2 */
 } mastodon_flags_t;
 
 typedef enum {
@@ -129,7 +128,7 @@ struct mastodon_data {
 
 	gpointer home_timeline_obj; /* of mastodon_list */
 	gpointer notifications_obj; /* of mastodon_list */
-	gpointer status_obj; /* of mastodon_status */
+	gpointer status_obj; /* of mastodon_list */
 	gpointer context_before_obj; /* of mastodon_list */
 	gpointer context_after_obj; /* of mastodon_list */
 
@@ -140,6 +139,8 @@ struct mastodon_data {
 
 	GSList *filters; /* of struct mastodon_filter */
 
+	GHashTable *accounts; /* of struct mastodon_account, by id; see mastodon_xt_get_user */
+
 	guint64 last_id; /* Information about our last status posted */
 	mastodon_visibility_t last_visibility;
 	char *last_spoiler_text;
@@ -165,6 +166,24 @@ struct mastodon_data {
 
 	char *name; /* Used to generate contact + channel name. */
 
+	int max_characters; /* Maximum length of a status according to the instance, 0 if unknown. */
+
+	int retry_attempt; /* How often the request being handled has been retried, see mastodon_http_retry. */
+	GSList *retries; /* Requests waiting to be repeated, see mastodon_http_retry. */
+
+	struct mastodon_record *record; /* NULL unless recording, see mastodon-record.h */
+	struct mastodon_stats *stats; /* see mastodon-stats.h */
+	struct mastodon_metrics_sink *metrics; /* NULL unless exporting metrics, see mastodon-metrics.h */
+	struct mastodon_trace *trace; /* see mastodon-trace.h */
+	struct mastodon_lag *lag; /* see mastodon-lag.h */
+	GHashTable *bursts; /* status id and type → struct mastodon_burst *, see mastodon-burst.h */
+	GHashTable *limits; /* struct http_request * → struct mastodon_limit *, see mastodon-limit.h */
+	gint limits_timer;
+	GHashTable *parse_queues; /* struct http_request * → GQueue of events being parsed, see mastodon-parse.h */
+	struct mastodon_wheel *wheel; /* see mastodon-wheel.h */
+	GHashTable *mutes; /* struct groupchat * → struct mastodon_mute *, see mastodon-mute.h */
+	struct mastodon_status_cache *status_cache; /* see mastodon-cache.h */
+
 	/* set show_ids */
 	struct mastodon_log_data *log;
 	int log_id;
@@ -209,10 +228,20 @@ extern GSList *mastodon_connections;
  */
 extern bee_user_t mastodon_log_local_user;
 
+/**
+ * What went wrong with a request. See mastodon_parse_error.
+ */
+struct mastodon_error {
+	int status; /* HTTP status code */
+	char message[256]; /* the "error" attribute of the reply, or empty */
+	int retry_after; /* seconds according to the Retry-After header, or -1 */
+};
+
 struct http_request;
-char *mastodon_parse_error(struct http_request *req);
+void mastodon_parse_error(struct http_request *req, struct mastodon_error *err);
 
 void mastodon_log(struct im_connection *ic, char *format, ...);
+char *mastodon_file_path(struct im_connection *ic, const char *name);
 void oauth2_init(struct im_connection *ic);
 struct groupchat *mastodon_groupchat_init(struct im_connection *ic);
 